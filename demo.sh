@@ -15,9 +15,8 @@ run_demo() {
 	# to run it.
 	cat "$1"
 	heading "P-Code IR"
-	./quadra "$3" > /tmp/prog.ll
-	heading "Compiling and running"
-	clang++ /tmp/prog.ll libmips_o32_linux.a -o /tmp/prog
+	./quadra -o /tmp/prog "$3"
+	heading "Running"
 	/tmp/prog
 	echo "exit code: $?"
 }
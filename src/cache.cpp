@@ -0,0 +1,149 @@
+#include "cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char CACHE_MAGIC[4] = {'Q', 'D', 'R', 'C'};
+static const uint64_t MAX_CALLEES = 1 << 20; // Anything more means the entry is corrupt.
+
+static void write_u64(FILE* file, uint64_t value);
+static void write_bytes(FILE* file, const std::string& bytes);
+static void write_bits(FILE* file, const std::vector<bool>& bits);
+static bool read_u64(FILE* file, uint64_t& value);
+static bool read_bytes(FILE* file, std::string& bytes);
+static bool read_bits(FILE* file, std::vector<bool>& bits);
+
+QuadraCache::QuadraCache(std::string directory)
+	: _directory(std::move(directory))
+{
+	std::error_code error;
+	fs::create_directories(_directory, error);
+	if(error) {
+		fprintf(stderr, "error: Failed to create cache directory %s: %s\n", _directory.c_str(), error.message().c_str());
+		exit(1);
+	}
+}
+
+bool QuadraCache::load(const std::string& key, CachedFunction& function) const
+{
+	FILE* file = fopen(path(key).c_str(), "rb");
+	if(file == nullptr) {
+		return false;
+	}
+	
+	// A truncated or otherwise unreadable entry is treated as a miss, and
+	// gets overwritten once the function has been translated again.
+	char magic[sizeof(CACHE_MAGIC)];
+	uint64_t count;
+	uint64_t calls_indirectly;
+	bool ok = fread(magic, sizeof(magic), 1, file) == 1
+		&& memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0
+		&& read_bytes(file, function.dependencies)
+		&& read_u64(file, count)
+		&& count <= MAX_CALLEES;
+	if(ok) {
+		function.callees.resize(count);
+		for(uint64_t& callee : function.callees) {
+			ok &= read_u64(file, callee);
+		}
+		ok = ok
+			&& read_u64(file, calls_indirectly)
+			&& read_bits(file, function.registers_read)
+			&& read_bits(file, function.registers_written)
+			&& read_bytes(file, function.bitcode);
+		function.calls_indirectly = calls_indirectly != 0;
+	}
+	fclose(file);
+	return ok;
+}
+
+void QuadraCache::store(const std::string& key, const CachedFunction& function) const
+{
+	std::string final_path = path(key);
+	std::error_code error;
+	fs::create_directories(fs::path(final_path).parent_path(), error);
+	
+	// Write to a file only this thread uses and then rename it into place, so
+	// readers never see a partial entry.
+	std::stringstream temp_path;
+	temp_path << final_path << ".tmp." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+	FILE* file = fopen(temp_path.str().c_str(), "wb");
+	if(file == nullptr) {
+		fprintf(stderr, "warning: Failed to write cache entry %s.\n", temp_path.str().c_str());
+		return;
+	}
+	fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, file);
+	write_bytes(file, function.dependencies);
+	write_u64(file, function.callees.size());
+	for(uint64_t callee : function.callees) {
+		write_u64(file, callee);
+	}
+	write_u64(file, function.calls_indirectly);
+	write_bits(file, function.registers_read);
+	write_bits(file, function.registers_written);
+	write_bytes(file, function.bitcode);
+	bool ok = !ferror(file);
+	ok &= fclose(file) == 0;
+	if(!ok || rename(temp_path.str().c_str(), final_path.c_str()) != 0) {
+		fprintf(stderr, "warning: Failed to write cache entry %s.\n", final_path.c_str());
+		remove(temp_path.str().c_str());
+	}
+}
+
+std::string QuadraCache::path(const std::string& key) const
+{
+	// Split on the first byte of the key like git does, to keep the
+	// directories small.
+	return (fs::path(_directory) / key.substr(0, 2) / key.substr(2)).string();
+}
+
+static void write_u64(FILE* file, uint64_t value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static void write_bytes(FILE* file, const std::string& bytes)
+{
+	write_u64(file, bytes.size());
+	fwrite(bytes.data(), 1, bytes.size(), file);
+}
+
+static void write_bits(FILE* file, const std::vector<bool>& bits)
+{
+	std::string bytes(bits.size(), '\0');
+	for(size_t i = 0; i < bits.size(); i++) {
+		bytes[i] = bits[i];
+	}
+	write_bytes(file, bytes);
+}
+
+static bool read_u64(FILE* file, uint64_t& value)
+{
+	return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool read_bytes(FILE* file, std::string& bytes)
+{
+	uint64_t size;
+	if(!read_u64(file, size) || size > (1ull << 32)) {
+		return false;
+	}
+	bytes.resize(size);
+	return fread(bytes.data(), 1, size, file) == size;
+}
+
+static bool read_bits(FILE* file, std::vector<bool>& bits)
+{
+	std::string bytes;
+	if(!read_bytes(file, bytes)) {
+		return false;
+	}
+	bits.assign(bytes.begin(), bytes.end());
+	return true;
+}
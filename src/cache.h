@@ -0,0 +1,37 @@
+#ifndef _QUADRA_CACHE_H
+#define _QUADRA_CACHE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// A translated function as stored in the cache.
+struct CachedFunction {
+	// Hash of the names and register summaries of the functions it was
+	// translated against. If any of those have changed the bitcode is stale.
+	std::string dependencies;
+	std::vector<uint64_t> callees;
+	bool calls_indirectly = false;
+	std::vector<bool> registers_read; // The function's local register summary.
+	std::vector<bool> registers_written;
+	std::string bitcode; // A module with just the function and declarations of what it uses.
+};
+
+// On-disk cache of translated functions. Entries are keyed by a hash of
+// everything that goes into translating a function, so they never have to be
+// invalidated, and are written atomically so that several translators can
+// share a directory.
+class QuadraCache {
+public:
+	QuadraCache(std::string directory);
+	
+	bool load(const std::string& key, CachedFunction& function) const;
+	void store(const std::string& key, const CachedFunction& function) const;
+	
+private:
+	std::string path(const std::string& key) const;
+	
+	std::string _directory;
+};
+
+#endif
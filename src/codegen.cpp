@@ -0,0 +1,390 @@
+#include "codegen.h"
+
+#include <map>
+#include <numeric>
+#include <set>
+#include <thread>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+extern char** environ;
+
+static std::unique_ptr<llvm::raw_fd_ostream> open_output(const std::string& path, llvm::sys::fs::OpenFlags flags);
+static void emit_object(llvm::Module& module, llvm::TargetMachine& target_machine, llvm::raw_pwrite_stream& out);
+static std::string emit_temporary_object(llvm::Module& module, llvm::TargetMachine& target_machine);
+static std::vector<std::string> emit_partitions(llvm::Module& module, llvm::TargetMachine& target_machine, unsigned int partitions);
+static std::map<const llvm::GlobalValue*, unsigned int> partition_module(llvm::Module& module, unsigned int partitions);
+static void user_partitions(const llvm::Value* value, const std::map<const llvm::GlobalValue*, unsigned int>& partitions, std::set<unsigned int>& result);
+static void run_cc(const std::vector<std::string>& args, const std::string& output_path);
+
+std::unique_ptr<llvm::TargetMachine> create_host_target_machine(llvm::Module& module, int optimization_level)
+{
+	llvm::InitializeNativeTarget();
+	llvm::InitializeNativeTargetAsmPrinter();
+	
+	std::string triple = llvm::sys::getDefaultTargetTriple();
+	std::string error;
+	const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+	if(target == nullptr) {
+		fprintf(stderr, "error: No LLVM target for %s: %s\n", triple.c_str(), error.c_str());
+		exit(1);
+	}
+	
+	llvm::CodeGenOpt::Level codegen_level;
+	switch(optimization_level) {
+		case 0: codegen_level = llvm::CodeGenOpt::None; break;
+		case 1: codegen_level = llvm::CodeGenOpt::Less; break;
+		case 2: codegen_level = llvm::CodeGenOpt::Default; break;
+		default: codegen_level = llvm::CodeGenOpt::Aggressive; break;
+	}
+	
+	// PIC, since the system linker produces PIEs by default.
+	std::unique_ptr<llvm::TargetMachine> target_machine(target->createTargetMachine(
+		triple,
+		llvm::sys::getHostCPUName(),
+		"",
+		llvm::TargetOptions(),
+		llvm::Reloc::PIC_,
+		llvm::None,
+		codegen_level));
+	
+	module.setTargetTriple(triple);
+	module.setDataLayout(target_machine->createDataLayout());
+	return target_machine;
+}
+
+OutputKind output_kind_from_path(const std::string& path)
+{
+	auto ends_with = [&](const char* extension) {
+		size_t size = strlen(extension);
+		return path.size() >= size && path.compare(path.size() - size, size, extension) == 0;
+	};
+	if(ends_with(".ll")) {
+		return OutputKind::LLVM_IR;
+	} else if(ends_with(".bc")) {
+		return OutputKind::BITCODE;
+	} else if(ends_with(".o")) {
+		return OutputKind::OBJECT;
+	} else {
+		return OutputKind::EXECUTABLE;
+	}
+}
+
+void write_output(llvm::Module& module, llvm::TargetMachine& target_machine, const QuadraOutputOptions& options)
+{
+	if(options.path.empty()) {
+		assert(options.kind == OutputKind::LLVM_IR);
+		module.print(llvm::outs(), nullptr);
+		return;
+	}
+	
+	switch(options.kind) {
+		case OutputKind::LLVM_IR: {
+			auto out = open_output(options.path, llvm::sys::fs::OF_Text);
+			module.print(*out, nullptr);
+			break;
+		}
+		case OutputKind::BITCODE: {
+			auto out = open_output(options.path, llvm::sys::fs::OF_None);
+			llvm::WriteBitcodeToFile(module, *out);
+			break;
+		}
+		case OutputKind::OBJECT: {
+			if(options.partitions <= 1) {
+				auto out = open_output(options.path, llvm::sys::fs::OF_None);
+				emit_object(module, target_machine, *out);
+				break;
+			}
+			// Combine the partitions into a single relocatable object.
+			std::vector<std::string> objects = emit_partitions(module, target_machine, options.partitions);
+			std::vector<std::string> args = {"-r"};
+			args.insert(args.end(), objects.begin(), objects.end());
+			args.insert(args.end(), {"-o", options.path});
+			run_cc(args, options.path);
+			for(const std::string& object : objects) {
+				llvm::sys::fs::remove(object);
+			}
+			break;
+		}
+		case OutputKind::EXECUTABLE: {
+			std::vector<std::string> objects;
+			if(options.partitions <= 1) {
+				objects.push_back(emit_temporary_object(module, target_machine));
+			} else {
+				objects = emit_partitions(module, target_machine, options.partitions);
+			}
+			// Floating point intrinsics like llvm.round can be lowered to libm
+			// calls.
+			std::vector<std::string> args = objects;
+			args.insert(args.end(), {options.runtime, "-lm", "-o", options.path});
+			run_cc(args, options.path);
+			for(const std::string& object : objects) {
+				llvm::sys::fs::remove(object);
+			}
+			break;
+		}
+	}
+}
+
+static std::unique_ptr<llvm::raw_fd_ostream> open_output(const std::string& path, llvm::sys::fs::OpenFlags flags)
+{
+	std::error_code error;
+	auto out = std::make_unique<llvm::raw_fd_ostream>(path, error, flags);
+	if(error) {
+		fprintf(stderr, "error: Failed to open %s for writing: %s\n", path.c_str(), error.message().c_str());
+		exit(1);
+	}
+	return out;
+}
+
+static void emit_object(llvm::Module& module, llvm::TargetMachine& target_machine, llvm::raw_pwrite_stream& out)
+{
+	// The code generator is still driven by the legacy pass manager.
+	llvm::legacy::PassManager passes;
+	if(target_machine.addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+		fprintf(stderr, "error: The host target can't emit object files.\n");
+		exit(1);
+	}
+	passes.run(module);
+	out.flush();
+}
+
+static std::string emit_temporary_object(llvm::Module& module, llvm::TargetMachine& target_machine)
+{
+	int fd;
+	llvm::SmallString<128> object_path;
+	if(std::error_code error = llvm::sys::fs::createTemporaryFile("quadra", "o", fd, object_path)) {
+		fprintf(stderr, "error: Failed to create temporary object file: %s\n", error.message().c_str());
+		exit(1);
+	}
+	llvm::raw_fd_ostream out(fd, true);
+	emit_object(module, target_machine, out);
+	return object_path.str().str();
+}
+
+static std::vector<std::string> emit_partitions(llvm::Module& module, llvm::TargetMachine& target_machine, unsigned int partitions)
+{
+	std::map<const llvm::GlobalValue*, unsigned int> partition_of = partition_module(module, partitions);
+	
+	// Anything local that's used by another partition has to be exported from
+	// its own. It's renamed so that it can't collide with the runtime or the
+	// C library, and hidden so that it isn't exported from the program.
+	for(llvm::GlobalValue& global : module.global_values()) {
+		if(global.isDeclaration() || !global.hasLocalLinkage()) {
+			continue;
+		}
+		std::set<unsigned int> users;
+		user_partitions(&global, partition_of, users);
+		users.erase(partition_of.at(&global));
+		if(!users.empty()) {
+			std::string name = "__quadra_local." + global.getName().str();
+			global.setName(name);
+			global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+			global.setVisibility(llvm::GlobalValue::HiddenVisibility);
+		}
+	}
+	
+	// Code generation needs a context per thread, so the partitions are
+	// handed over as bitcode. Definitions from other partitions become
+	// declarations.
+	std::vector<std::string> bitcode(partitions);
+	for(unsigned int i = 0; i < partitions; i++) {
+		llvm::ValueToValueMapTy values;
+		std::unique_ptr<llvm::Module> partition = llvm::CloneModule(module, values, [&](const llvm::GlobalValue* global) {
+			return partition_of.at(global) == i;
+		});
+		llvm::raw_string_ostream stream(bitcode[i]);
+		llvm::WriteBitcodeToFile(*partition, stream);
+	}
+	
+	std::vector<std::string> objects(partitions);
+	auto generate = [&](unsigned int i) {
+		llvm::LLVMContext context;
+		llvm::Expected<std::unique_ptr<llvm::Module>> partition = llvm::parseBitcodeFile(
+			llvm::MemoryBufferRef(bitcode[i], "partition"), context);
+		if(!partition) {
+			fprintf(stderr, "error: Failed to read back partition %u: %s\n", i, llvm::toString(partition.takeError()).c_str());
+			exit(1);
+		}
+		std::unique_ptr<llvm::TargetMachine> partition_machine(target_machine.getTarget().createTargetMachine(
+			target_machine.getTargetTriple().str(),
+			target_machine.getTargetCPU(),
+			target_machine.getTargetFeatureString(),
+			target_machine.Options,
+			target_machine.getRelocationModel(),
+			target_machine.getCodeModel(),
+			target_machine.getOptLevel()));
+		objects[i] = emit_temporary_object(**partition, *partition_machine);
+	};
+	std::vector<std::thread> threads;
+	for(unsigned int i = 1; i < partitions; i++) {
+		threads.emplace_back(generate, i);
+	}
+	generate(0);
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+	return objects;
+}
+
+// Cluster functions along the call graph and then spread the clusters over
+// the partitions, biggest first. A function goes with the only function that
+// calls it, and with the only function it calls, which pairs each translated
+// function with its body. No cluster grows past an even share of the module,
+// so a popular callee can't drag everything into one partition. Global
+// variables go with the first partition that uses them.
+static std::map<const llvm::GlobalValue*, unsigned int> partition_module(llvm::Module& module, unsigned int partitions)
+{
+	std::vector<llvm::Function*> functions;
+	std::map<const llvm::Function*, size_t> indices;
+	for(llvm::Function& function : module) {
+		if(!function.isDeclaration()) {
+			indices[&function] = functions.size();
+			functions.push_back(&function);
+		}
+	}
+	
+	std::vector<std::set<size_t>> callers(functions.size());
+	std::vector<std::set<size_t>> callees(functions.size());
+	std::vector<size_t> sizes(functions.size());
+	size_t total_size = 0;
+	for(size_t i = 0; i < functions.size(); i++) {
+		for(llvm::Instruction& instruction : llvm::instructions(functions[i])) {
+			llvm::CallBase* call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+			auto callee = call != nullptr ? indices.find(call->getCalledFunction()) : indices.end();
+			if(callee != indices.end() && callee->second != i) {
+				callers[callee->second].insert(i);
+				callees[i].insert(callee->second);
+			}
+		}
+		sizes[i] = functions[i]->getInstructionCount() + 1;
+		total_size += sizes[i];
+	}
+	
+	std::vector<size_t> leaders(functions.size());
+	std::iota(leaders.begin(), leaders.end(), 0);
+	std::vector<size_t> cluster_sizes = sizes;
+	size_t max_cluster_size = std::max<size_t>(total_size / partitions, 1);
+	auto find = [&](size_t i) {
+		while(leaders[i] != i) {
+			leaders[i] = leaders[leaders[i]];
+			i = leaders[i];
+		}
+		return i;
+	};
+	auto merge = [&](size_t a, size_t b) {
+		a = find(a);
+		b = find(b);
+		if(a != b && cluster_sizes[a] + cluster_sizes[b] <= max_cluster_size) {
+			leaders[b] = a;
+			cluster_sizes[a] += cluster_sizes[b];
+		}
+	};
+	for(size_t i = 0; i < functions.size(); i++) {
+		if(callees[i].size() == 1) {
+			merge(*callees[i].begin(), i);
+		}
+	}
+	for(size_t i = 0; i < functions.size(); i++) {
+		std::set<size_t> calling_clusters;
+		for(size_t caller : callers[i]) {
+			calling_clusters.insert(find(caller));
+		}
+		calling_clusters.erase(find(i));
+		if(calling_clusters.size() == 1) {
+			merge(*calling_clusters.begin(), i);
+		}
+	}
+	
+	std::vector<size_t> clusters;
+	for(size_t i = 0; i < functions.size(); i++) {
+		if(find(i) == i) {
+			clusters.push_back(i);
+		}
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [&](size_t l, size_t r) {
+		return cluster_sizes[l] > cluster_sizes[r];
+	});
+	std::vector<size_t> loads(partitions, 0);
+	std::map<size_t, unsigned int> cluster_partitions;
+	for(size_t cluster : clusters) {
+		unsigned int partition = std::min_element(loads.begin(), loads.end()) - loads.begin();
+		cluster_partitions[cluster] = partition;
+		loads[partition] += cluster_sizes[cluster];
+	}
+	
+	std::map<const llvm::GlobalValue*, unsigned int> result;
+	for(size_t i = 0; i < functions.size(); i++) {
+		result[functions[i]] = cluster_partitions.at(find(i));
+	}
+	for(llvm::GlobalVariable& global : module.globals()) {
+		if(!global.isDeclaration()) {
+			std::set<unsigned int> users;
+			user_partitions(&global, result, users);
+			result[&global] = users.empty() ? 0 : *users.begin();
+		}
+	}
+	for(llvm::GlobalValue& global : module.global_values()) {
+		if(!global.isDeclaration() && result.count(&global) == 0) {
+			result[&global] = 0; // Aliases and the like.
+		}
+	}
+	return result;
+}
+
+// Add the partitions of the functions and global variables that refer to a
+// value, looking through constant expressions.
+static void user_partitions(const llvm::Value* value, const std::map<const llvm::GlobalValue*, unsigned int>& partitions, std::set<unsigned int>& result)
+{
+	for(const llvm::User* user : value->users()) {
+		if(const llvm::Instruction* instruction = llvm::dyn_cast<llvm::Instruction>(user)) {
+			result.insert(partitions.at(instruction->getFunction()));
+		} else if(const llvm::GlobalValue* global = llvm::dyn_cast<llvm::GlobalValue>(user)) {
+			auto iter = partitions.find(global);
+			if(iter != partitions.end()) {
+				result.insert(iter->second);
+			}
+		} else {
+			user_partitions(user, partitions, result);
+		}
+	}
+}
+
+static void run_cc(const std::vector<std::string>& args, const std::string& output_path)
+{
+	// Let the C compiler driver find the system linker and the C library.
+	const char* cc = getenv("CC");
+	if(cc == nullptr) {
+		cc = "cc";
+	}
+	std::vector<std::string> cc_args = {cc};
+	cc_args.insert(cc_args.end(), args.begin(), args.end());
+	std::vector<char*> argv;
+	for(std::string& arg : cc_args) {
+		argv.push_back(arg.data());
+	}
+	argv.push_back(nullptr);
+	
+	pid_t pid;
+	if(posix_spawnp(&pid, cc, nullptr, nullptr, argv.data(), environ) != 0) {
+		fprintf(stderr, "error: Failed to run %s.\n", cc);
+		exit(1);
+	}
+	int status;
+	if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "error: Linking %s failed.\n", output_path.c_str());
+		exit(1);
+	}
+}
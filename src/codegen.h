@@ -0,0 +1,37 @@
+#ifndef _QUADRA_CODEGEN_H
+#define _QUADRA_CODEGEN_H
+
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+enum class OutputKind {
+	LLVM_IR,
+	BITCODE,
+	OBJECT,
+	EXECUTABLE
+};
+
+struct QuadraOutputOptions {
+	OutputKind kind = OutputKind::LLVM_IR;
+	std::string path; // Empty for stdout, only allowed for LLVM IR.
+	std::string runtime; // Syscall runtime library to link executables against.
+	
+	// Split the module into this many partitions for code generation, which
+	// are compiled on their own threads and linked back together. Only
+	// affects object files and executables.
+	unsigned int partitions = 1;
+};
+
+// Create a target machine for the host, and point the module at it.
+std::unique_ptr<llvm::TargetMachine> create_host_target_machine(llvm::Module& module, int optimization_level);
+
+// Guess the output kind from the extension of the output path.
+OutputKind output_kind_from_path(const std::string& path);
+
+// Splitting into partitions modifies the module, so it can't be used again
+// afterwards.
+void write_output(llvm::Module& module, llvm::TargetMachine& target_machine, const QuadraOutputOptions& options);
+
+#endif
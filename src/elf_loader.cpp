@@ -1,22 +1,43 @@
 #include "elf_loader.h"
 
+#include <algorithm>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 ElfLoader::ElfLoader(std::string elf_path)
 	: LoadImage(elf_path)
-	, _file(elf_path, std::ios::binary)
 {
-	_file.seekg(0, std::ios::end);
-	_file_size = _file.tellg();
+	int fd = open(elf_path.c_str(), O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "error: Failed to open ELF file '%s'.\n", elf_path.c_str());
+		exit(1);
+	}
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		fprintf(stderr, "error: Failed to stat ELF file '%s'.\n", elf_path.c_str());
+		exit(1);
+	}
+	_file_size = file_stat.st_size;
+	void* mapping = mmap(nullptr, _file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		fprintf(stderr, "error: Failed to map ELF file '%s'.\n", elf_path.c_str());
+		exit(1);
+	}
+	_file = (const uint8_t*) mapping;
 	
-	_ident = read_packed<ElfIdentHeader>(_file, 0);
+	_ident = read<ElfIdentHeader>(0);
 	if(memcmp(_ident.magic, "\x7f\x45\x4c\x46", 4) != 0) {
 		fprintf(stderr, "error: Not a valid ELF file.\n");
 		exit(1);
 	}
 	switch(_ident.e_class) {
 		case ElfIdentClass::B32: {
-			ElfFileHeader32 header32 = read_packed<ElfFileHeader32>(_file);
+			ElfFileHeader32 header32 = read<ElfFileHeader32>(sizeof(ElfIdentHeader));
 			_header.type      = header32.type;
 			_header.machine   = header32.machine;
 			_header.version   = header32.version;
@@ -31,9 +52,8 @@ ElfLoader::ElfLoader(std::string elf_path)
 			_header.shnum     = header32.shnum;
 			_header.shstrndx  = header32.shstrndx;
 			
-			_file.seekg(_header.phoff, std::ios::beg);
-			for(uint32_t i = 0; i < _header.phnum; i++) {
-				ElfProgramHeader32 segment32 = read_packed<ElfProgramHeader32>(_file);
+			auto segments32 = read_multiple<ElfProgramHeader32>(_header.phoff, _header.phnum);
+			for(ElfProgramHeader32& segment32 : segments32) {
 				ElfProgramHeader64& segment = _segments.emplace_back();
 				segment.type   = segment32.type;
 				segment.flags  = segment32.flags;
@@ -47,8 +67,8 @@ ElfLoader::ElfLoader(std::string elf_path)
 			break;
 		}
 		case ElfIdentClass::B64: {
-			_header = read_packed<ElfFileHeader64>(_file);
-			_segments = read_multiple_packed<ElfProgramHeader64>(_file, _header.phoff, _header.phnum);
+			_header = read<ElfFileHeader64>(sizeof(ElfIdentHeader));
+			_segments = read_multiple<ElfProgramHeader64>(_header.phoff, _header.phnum);
 			break;
 		}
 		default: {
@@ -56,6 +76,43 @@ ElfLoader::ElfLoader(std::string elf_path)
 			exit(1);
 		}
 	}
+	
+	// Build a sorted index of the loadable segments so that address lookups
+	// are a binary search rather than a scan over every program header.
+	for(size_t i = 0; i < _segments.size(); i++) {
+		const ElfProgramHeader64& segment = _segments[i];
+		if(segment.type != PT_LOAD || segment.memsz == 0) {
+			continue;
+		}
+		check_file_range(segment.offset, segment.filesz, "segment");
+		if(segment.filesz > segment.memsz) {
+			fprintf(stderr, "error: Segment at 0x%08lx has filesz > memsz.\n", segment.vaddr);
+			exit(1);
+		}
+		_load_segments.push_back(i);
+	}
+	std::sort(_load_segments.begin(), _load_segments.end(), [&](size_t l, size_t r) {
+		return _segments[l].vaddr < _segments[r].vaddr;
+	});
+	
+	read_section_headers();
+	for(const ElfSectionHeader64& section : _sections) {
+		if(section.type == SHT_SYMTAB || section.type == SHT_DYNSYM) {
+			read_function_symbols(section);
+		}
+	}
+	// .symtab comes before .dynsym in practice, and stable_sort keeps the
+	// first name seen for each address.
+	std::stable_sort(_function_symbols.begin(), _function_symbols.end(),
+		[](const ElfFunctionSymbol& l, const ElfFunctionSymbol& r) { return l.address < r.address; });
+	auto last = std::unique(_function_symbols.begin(), _function_symbols.end(),
+		[](const ElfFunctionSymbol& l, const ElfFunctionSymbol& r) { return l.address == r.address; });
+	_function_symbols.erase(last, _function_symbols.end());
+}
+
+ElfLoader::~ElfLoader()
+{
+	munmap((void*) _file, _file_size);
 }
 
 std::string ElfLoader::getArchType() const
@@ -77,22 +134,40 @@ void ElfLoader::adjustVma(long adjust)
 
 void ElfLoader::loadFill(uint1* ptr, int4 size, const Address& addr)
 {
-	uint64_t file_offset = file_offset_from_virtual_address(addr.getOffset());
-	_file.seekg(file_offset);
-	_file.read((char*) ptr, size);
-	if(_file.gcount() != size) {
-		fprintf(stderr, "error: Failed to load %x bytes from %08lx in ELF file.", size, file_offset);
+	uint64_t virtual_address = addr.getOffset();
+	if(segment_containing(virtual_address) == nullptr) {
+		fprintf(stderr, "error: Failed to load %x bytes from unmapped address 0x%08lx.\n", size, virtual_address);
 		exit(1);
 	}
+	
+	// Ghidra fetches fixed size chunks, which may run off the end of the file
+	// image of a segment (into .bss) or off the end of the segment entirely,
+	// so anything not backed by the file is filled with zeroes.
+	while(size > 0) {
+		const ElfProgramHeader64* segment = segment_containing(virtual_address);
+		if(segment == nullptr) {
+			memset(ptr, 0, size);
+			return;
+		}
+		uint64_t offset = virtual_address - segment->vaddr;
+		uint64_t chunk = std::min<uint64_t>(size, segment->memsz - offset);
+		uint64_t file_chunk = 0;
+		if(offset < segment->filesz) {
+			file_chunk = std::min<uint64_t>(chunk, segment->filesz - offset);
+			memcpy(ptr, _file + segment->offset + offset, file_chunk);
+		}
+		memset(ptr + file_chunk, 0, chunk - file_chunk);
+		ptr += chunk;
+		size -= chunk;
+		virtual_address += chunk;
+	}
 }
 
 uint64_t ElfLoader::file_offset_from_virtual_address(uint64_t virtual_address)
 {
-	for(ElfProgramHeader64& segment : _segments) {
-		uint64_t top = segment.vaddr + segment.filesz;
-		if(virtual_address >= segment.vaddr && virtual_address < top) {
-			return segment.offset + (virtual_address - segment.vaddr);
-		}
+	const ElfProgramHeader64* segment = segment_containing(virtual_address);
+	if(segment != nullptr && virtual_address < segment->vaddr + segment->filesz) {
+		return segment->offset + (virtual_address - segment->vaddr);
 	}
 	fprintf(stderr, "error: Tried to translate unmapped virtual address 0x%08lx.\n", virtual_address);
 	exit(1);
@@ -100,13 +175,158 @@ uint64_t ElfLoader::file_offset_from_virtual_address(uint64_t virtual_address)
 }
 
 uint64_t ElfLoader::top_of_segment_containing(uint64_t virtual_address) {
-	for(ElfProgramHeader64& segment : _segments) {
-		uint64_t top = segment.vaddr + segment.filesz;
-		if(virtual_address >= segment.vaddr && virtual_address < top) {
-			return top;
-		}
+	const ElfProgramHeader64* segment = segment_containing(virtual_address);
+	if(segment != nullptr && virtual_address < segment->vaddr + segment->filesz) {
+		return segment->vaddr + segment->filesz;
 	}
 	fprintf(stderr, "error: Tried to calculate bounmds of segment containing unmapped virtual address 0x%08lx.\n", virtual_address);
 	exit(1);
 	return 0;
 }
+
+const ElfProgramHeader64* ElfLoader::segment_containing(uint64_t virtual_address)
+{
+	auto contains = [&](size_t index) {
+		const ElfProgramHeader64& segment = _segments[_load_segments[index]];
+		return virtual_address >= segment.vaddr && virtual_address - segment.vaddr < segment.memsz;
+	};
+	
+	// Consecutive fetches almost always hit the same segment.
+	if(_last_segment < _load_segments.size() && contains(_last_segment)) {
+		return &_segments[_load_segments[_last_segment]];
+	}
+	
+	// Find the last segment starting at or before the address.
+	auto iter = std::upper_bound(_load_segments.begin(), _load_segments.end(), virtual_address,
+		[&](uint64_t address, size_t index) { return address < _segments[index].vaddr; });
+	if(iter == _load_segments.begin()) {
+		return nullptr;
+	}
+	size_t index = (iter - _load_segments.begin()) - 1;
+	if(!contains(index)) {
+		return nullptr;
+	}
+	_last_segment = index;
+	return &_segments[_load_segments[index]];
+}
+
+std::vector<const ElfProgramHeader64*> ElfLoader::load_segments() const
+{
+	std::vector<const ElfProgramHeader64*> segments;
+	for(size_t index : _load_segments) {
+		segments.push_back(&_segments[index]);
+	}
+	return segments;
+}
+
+const ElfFunctionSymbol* ElfLoader::function_symbol(uint64_t address) const
+{
+	auto iter = std::lower_bound(_function_symbols.begin(), _function_symbols.end(), address,
+		[](const ElfFunctionSymbol& symbol, uint64_t address) { return symbol.address < address; });
+	if(iter == _function_symbols.end() || iter->address != address) {
+		return nullptr;
+	}
+	return &*iter;
+}
+
+void ElfLoader::read_section_headers()
+{
+	if(_header.shoff == 0 || _header.shnum == 0) {
+		return; // Stripped of section headers, nothing to do.
+	}
+	switch(_ident.e_class) {
+		case ElfIdentClass::B32: {
+			auto sections32 = read_multiple<ElfSectionHeader32>(_header.shoff, _header.shnum);
+			for(ElfSectionHeader32& section32 : sections32) {
+				ElfSectionHeader64& section = _sections.emplace_back();
+				section.name      = section32.name;
+				section.type      = section32.type;
+				section.flags     = section32.flags;
+				section.addr      = section32.addr;
+				section.offset    = section32.offset;
+				section.size      = section32.size;
+				section.link      = section32.link;
+				section.info      = section32.info;
+				section.addralign = section32.addralign;
+				section.entsize   = section32.entsize;
+			}
+			break;
+		}
+		case ElfIdentClass::B64: {
+			_sections = read_multiple<ElfSectionHeader64>(_header.shoff, _header.shnum);
+			break;
+		}
+	}
+}
+
+void ElfLoader::read_function_symbols(const ElfSectionHeader64& symtab)
+{
+	if(symtab.link >= _sections.size()) {
+		fprintf(stderr, "warning: Symbol table has a bad string table index, skipping.\n");
+		return;
+	}
+	const ElfSectionHeader64& strtab = _sections[symtab.link];
+	
+	auto add_symbol = [&](uint32_t name, uint8_t info, uint16_t shndx, uint64_t value, uint64_t size) {
+		if(ELF64_ST_TYPE(info) != STT_FUNC || shndx == SHN_UNDEF || value == 0) {
+			return;
+		}
+		ElfFunctionSymbol& symbol = _function_symbols.emplace_back();
+		symbol.name = read_string(strtab, name);
+		symbol.address = value;
+		symbol.size = size;
+	};
+	
+	switch(_ident.e_class) {
+		case ElfIdentClass::B32: {
+			auto symbols = read_multiple<ElfSymbol32>(symtab.offset, symtab.size / sizeof(ElfSymbol32));
+			for(ElfSymbol32& symbol : symbols) {
+				add_symbol(symbol.name, symbol.info, symbol.shndx, symbol.value, symbol.size);
+			}
+			break;
+		}
+		case ElfIdentClass::B64: {
+			auto symbols = read_multiple<ElfSymbol64>(symtab.offset, symtab.size / sizeof(ElfSymbol64));
+			for(ElfSymbol64& symbol : symbols) {
+				add_symbol(symbol.name, symbol.info, symbol.shndx, symbol.value, symbol.size);
+			}
+			break;
+		}
+	}
+}
+
+std::string ElfLoader::read_string(const ElfSectionHeader64& strtab, uint32_t offset) const
+{
+	check_file_range(strtab.offset, strtab.size, "string table");
+	if(offset >= strtab.size) {
+		return "";
+	}
+	const char* begin = (const char*) &_file[strtab.offset + offset];
+	return std::string(begin, strnlen(begin, strtab.size - offset));
+}
+
+template <typename T>
+T ElfLoader::read(uint64_t offset) const
+{
+	check_file_range(offset, sizeof(T), "header");
+	T packed;
+	memcpy(&packed, _file + offset, sizeof(T));
+	return packed;
+}
+
+template <typename T>
+std::vector<T> ElfLoader::read_multiple(uint64_t offset, uint64_t count) const
+{
+	check_file_range(offset, sizeof(T) * count, "table");
+	std::vector<T> packed(count);
+	memcpy(packed.data(), _file + offset, sizeof(T) * count);
+	return packed;
+}
+
+void ElfLoader::check_file_range(uint64_t offset, uint64_t size, const char* what) const
+{
+	if(offset > _file_size || size > _file_size - offset) {
+		fprintf(stderr, "error: ELF %s at 0x%lx (size 0x%lx) is out of bounds.\n", what, offset, size);
+		exit(1);
+	}
+}
@@ -95,25 +95,108 @@ packed_struct(ElfProgramHeader64,
 	uint64_t align;  // 0x30
 )
 
+packed_struct(ElfSectionHeader32,
+	uint32_t name;      // 0x0
+	uint32_t type;      // 0x4
+	uint32_t flags;     // 0x8
+	uint32_t addr;      // 0xc
+	uint32_t offset;    // 0x10
+	uint32_t size;      // 0x14
+	uint32_t link;      // 0x18
+	uint32_t info;      // 0x1c
+	uint32_t addralign; // 0x20
+	uint32_t entsize;   // 0x24
+)
+
+packed_struct(ElfSectionHeader64,
+	uint32_t name;      // 0x0
+	uint32_t type;      // 0x4
+	uint64_t flags;     // 0x8
+	uint64_t addr;      // 0x10
+	uint64_t offset;    // 0x18
+	uint64_t size;      // 0x20
+	uint32_t link;      // 0x28
+	uint32_t info;      // 0x2c
+	uint64_t addralign; // 0x30
+	uint64_t entsize;   // 0x38
+)
+
+packed_struct(ElfSymbol32,
+	uint32_t name;  // 0x0
+	uint32_t value; // 0x4
+	uint32_t size;  // 0x8
+	uint8_t info;   // 0xc
+	uint8_t other;  // 0xd
+	uint16_t shndx; // 0xe
+)
+
+packed_struct(ElfSymbol64,
+	uint32_t name;  // 0x0
+	uint8_t info;   // 0x4
+	uint8_t other;  // 0x5
+	uint16_t shndx; // 0x6
+	uint64_t value; // 0x8
+	uint64_t size;  // 0x10
+)
+
+struct ElfFunctionSymbol {
+	std::string name;
+	uint64_t address;
+	uint64_t size;
+};
+
+// Maps the whole ELF file into memory once so that loadFill, which Ghidra
+// calls for every instruction it decodes, is just a segment lookup and a
+// memcpy.
 class ElfLoader : public LoadImage {
 public:
 	ElfLoader(std::string elf_path);
-	~ElfLoader() override {}
+	~ElfLoader() override;
 	void loadFill(uint1* ptr, int4 size, const Address& addr) override;
 	string getArchType() const override;
 	void adjustVma(long adjust) override;
 	
 	uint64_t entry_point() const { return _header.entry; }
 	ElfMachine machine() const { return _header.machine; }
+	bool is_32_bit() const { return _ident.e_class == ElfIdentClass::B32; }
 	uint64_t file_offset_from_virtual_address(uint64_t virtual_address);
 	uint64_t top_of_segment_containing(uint64_t virtual_address);
+	
+	// Returns the PT_LOAD segment whose memory image contains the given
+	// address, or nullptr if the address is unmapped.
+	const ElfProgramHeader64* segment_containing(uint64_t virtual_address);
+	
+	// The PT_LOAD segments, sorted by vaddr.
+	std::vector<const ElfProgramHeader64*> load_segments() const;
+	// The part of the file backing a segment, filesz bytes long.
+	const uint8_t* segment_data(const ElfProgramHeader64& segment) const { return _file + segment.offset; }
+	
+	// All the STT_FUNC symbols from .symtab and .dynsym, sorted by address
+	// with duplicates removed.
+	const std::vector<ElfFunctionSymbol>& function_symbols() const { return _function_symbols; }
+	// The STT_FUNC symbol starting at the given address, or nullptr.
+	const ElfFunctionSymbol* function_symbol(uint64_t address) const;
 
 private:
-	std::ifstream _file;
-	size_t _file_size;
+	void read_section_headers();
+	void read_function_symbols(const ElfSectionHeader64& symtab);
+	std::string read_string(const ElfSectionHeader64& strtab, uint32_t offset) const;
+	
+	template <typename T>
+	T read(uint64_t offset) const;
+	template <typename T>
+	std::vector<T> read_multiple(uint64_t offset, uint64_t count) const;
+	void check_file_range(uint64_t offset, uint64_t size, const char* what) const;
+	
+	const uint8_t* _file = nullptr;
+	size_t _file_size = 0;
 	ElfIdentHeader _ident;
 	ElfFileHeader64 _header;
 	std::vector<ElfProgramHeader64> _segments;
+	std::vector<ElfSectionHeader64> _sections;
+	std::vector<ElfFunctionSymbol> _function_symbols;
+	std::vector<size_t> _load_segments; // Indices into _segments of PT_LOAD segments, sorted by vaddr.
+	size_t _last_segment = 0; // Index into _load_segments of the last segment hit.
 };
 
 #endif
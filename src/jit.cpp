@@ -0,0 +1,42 @@
+#include "jit.h"
+
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/TargetSelect.h>
+
+static void exit_on_error(llvm::Error error, const char* what);
+
+int run_jit(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context)
+{
+	llvm::InitializeNativeTarget();
+	llvm::InitializeNativeTargetAsmPrinter();
+	
+	auto jit = llvm::orc::LLLazyJITBuilder().create();
+	exit_on_error(jit.takeError(), "create the JIT");
+	
+	// Resolve the qsys_* functions, the memory setup code and anything from
+	// the C library against quadra's own symbols.
+	auto process_symbols = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+		(*jit)->getDataLayout().getGlobalPrefix());
+	exit_on_error(process_symbols.takeError(), "search the process for symbols");
+	(*jit)->getMainJITDylib().addGenerator(std::move(*process_symbols));
+	
+	// The default partitioning only compiles the function being called, with
+	// calls out of it going through stubs that compile their target.
+	module->setDataLayout((*jit)->getDataLayout());
+	llvm::orc::ThreadSafeModule thread_safe_module(std::move(module), std::move(context));
+	exit_on_error((*jit)->addLazyIRModule(std::move(thread_safe_module)), "add the module to the JIT");
+	
+	auto main_symbol = (*jit)->lookup("main");
+	exit_on_error(main_symbol.takeError(), "find main");
+	auto main = (int (*)()) main_symbol->getAddress();
+	return main();
+}
+
+static void exit_on_error(llvm::Error error, const char* what)
+{
+	if(error) {
+		fprintf(stderr, "error: Failed to %s: %s\n", what, llvm::toString(std::move(error)).c_str());
+		exit(1);
+	}
+}
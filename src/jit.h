@@ -0,0 +1,12 @@
+#ifndef _QUADRA_JIT_H
+#define _QUADRA_JIT_H
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+// Run the translated program in-process with ORC. Functions are only
+// compiled the first time they're called, and the syscall runtime linked
+// into quadra itself is used. Returns the program's exit code.
+int run_jit(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context);
+
+#endif
@@ -1,5 +1,8 @@
+#include <atomic>
 #include <iostream>
 #include <filesystem>
+#include <sstream>
+#include <thread>
 
 #include <decompile/cpp/libdecomp.hh>
 #include <decompile/cpp/loadimage.hh>
@@ -10,11 +13,16 @@
 #include "quadra_architecture.h"
 #include "elf_loader.h"
 #include "translator.h"
+#include "optimizer.h"
+#include "codegen.h"
+#include "jit.h"
 
 namespace fs = std::filesystem;
 
-void disassemble_pcodeop(const Translate& translate, size_t index, const PcodeOp& op);
-void print_vardata(const Translate& translate, const Varnode& var);
+void print_usage();
+void translate_function(QuadraTranslator& translator, const QuadraFunction& function, const Translate& translate);
+void disassemble_pcodeop(std::ostream& out, const Translate& translate, size_t index, const PcodeOp& op);
+void print_vardata(std::ostream& out, const Translate& translate, const Varnode& var);
 
 int main(int argc, char** argv)
 {
@@ -26,11 +34,82 @@ int main(int argc, char** argv)
 	
 	startDecompilerLibrary(ghidra_dir);
 	
-	if(argc < 2) {
-		printf("usage: GHIDRA_DIR=/path/to/ghidra ./quadra /path/to/executable\n");
+	const char* binary_path = nullptr;
+	QuadraTranslatorOptions options;
+	QuadraOptimizerOptions optimizer_options;
+	QuadraOutputOptions output_options;
+	std::string emit;
+	bool run = false;
+	bool pcode_stats = false;
+	bool all_symbols = false;
+	unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1u);
+	output_options.runtime = (fs::path(argv[0]).parent_path() / "libmips_o32_linux.a").string();
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--no-ssa") {
+			options.ssa = false;
+		} else if(arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+			optimizer_options.level = arg[2] - '0';
+		} else if(arg == "--time-passes") {
+			optimizer_options.time_passes = true;
+		} else if(arg == "-o" && i + 1 < argc) {
+			output_options.path = argv[++i];
+		} else if(arg == "--emit" && i + 1 < argc) {
+			emit = argv[++i];
+		} else if(arg == "-j" && i + 1 < argc) {
+			jobs = std::max(atoi(argv[++i]), 1);
+		} else if(arg == "--partitions" && i + 1 < argc) {
+			output_options.partitions = std::max(atoi(argv[++i]), 1);
+		} else if(arg == "--run") {
+			run = true;
+		} else if(arg == "--no-pcode-opt") {
+			options.optimize_pcode = false;
+		} else if(arg == "--pcode-stats") {
+			pcode_stats = true;
+		} else if(arg == "--all-symbols") {
+			all_symbols = true;
+		} else if(arg == "--instrument") {
+			options.instrument = true;
+		} else if(arg == "--profile" && i + 1 < argc) {
+			options.profile_path = argv[++i];
+		} else if(arg == "--fast-math") {
+			options.fast_math = true;
+		} else if(arg == "--cache" && i + 1 < argc) {
+			options.cache_directory = argv[++i];
+		} else if(arg == "--stream" && i + 1 < argc) {
+			options.stream_directory = argv[++i];
+		} else if(arg == "--runtime" && i + 1 < argc) {
+			output_options.runtime = argv[++i];
+		} else if(arg.size() > 0 && arg[0] != '-' && binary_path == nullptr) {
+			binary_path = argv[i];
+		} else {
+			print_usage();
+		}
+	}
+	if(binary_path == nullptr) {
+		print_usage();
+	}
+	if(emit.empty()) {
+		output_options.kind = output_options.path.empty() ? OutputKind::LLVM_IR : output_kind_from_path(output_options.path);
+	} else if(emit == "ll") {
+		output_options.kind = OutputKind::LLVM_IR;
+	} else if(emit == "bc") {
+		output_options.kind = OutputKind::BITCODE;
+	} else if(emit == "obj") {
+		output_options.kind = OutputKind::OBJECT;
+	} else if(emit == "exe") {
+		output_options.kind = OutputKind::EXECUTABLE;
+	} else {
+		print_usage();
+	}
+	if(run && !output_options.path.empty()) {
+		fprintf(stderr, "error: --run doesn't write any output, so it can't be used with -o.\n");
+		exit(1);
+	}
+	if(output_options.path.empty() && output_options.kind != OutputKind::LLVM_IR) {
+		fprintf(stderr, "error: Only LLVM IR can be written to stdout, use -o.\n");
 		exit(1);
 	}
-	const char* binary_path = argv[1];
 	QuadraArchitecture arch(binary_path, "", &std::cerr);
 	DocumentStorage document_storage;
 	try {
@@ -41,85 +120,172 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 	
-	QuadraTranslator pcode_to_llvm(&arch);
+	QuadraTranslator pcode_to_llvm(&arch, options);
+	llvm::Module& module = pcode_to_llvm.module();
+	std::unique_ptr<llvm::TargetMachine> target_machine = create_host_target_machine(module, optimizer_options.level);
+	ElfLoader* loader = (ElfLoader*) arch.loader;
 	
-	uint64_t entry_point = ((ElfLoader*) arch.loader)->entry_point();
+	uint64_t entry_point = loader->entry_point();
 	Address entry_point_addr(arch.translate->getDefaultCodeSpace(), entry_point);
 	
-	// Create the Ghidra/LLVM function objects.
-	pcode_to_llvm.get_function(entry_point_addr, "main");
+	// Create the Ghidra/LLVM function objects. Functions are found by
+	// following calls from the entry point, and with --all-symbols everything
+	// in the symbol table is seeded up front too, reachable or not.
+	if(all_symbols) {
+		for(const ElfFunctionSymbol& symbol : loader->function_symbols()) {
+			Address address(arch.translate->getDefaultCodeSpace(), symbol.address);
+			pcode_to_llvm.get_function(address, nullptr, symbol.size);
+		}
+	}
+	QuadraFunction* entry = pcode_to_llvm.get_function(entry_point_addr);
+	pcode_to_llvm.create_main(entry->llvm);
+	pcode_to_llvm.load_cached_functions();
 	
-	while(pcode_to_llvm.discovered_functions.size() > 0) {
-		Address address = pcode_to_llvm.discovered_functions.begin()->first;
-		auto node_handle = pcode_to_llvm.discovered_functions.extract(address);
-		QuadraFunction function = std::move(node_handle.mapped());
-		
-		const BlockGraph* blocks = &function.ghidra->getBasicBlocks();
-		pcode_to_llvm.begin_function(std::move(function));
+	// Ghidra has already done its part for every function, so the rest can
+	// be split across threads. The parent translator lowers functions too.
+	std::vector<const QuadraFunction*> functions;
+	for(auto& [_, function] : pcode_to_llvm.discovered_functions) {
+		if(!function.cached) {
+			functions.push_back(&function);
+		}
+	}
+	// Target machines cache subtargets without any locking, so each worker
+	// gets its own.
+	std::vector<std::unique_ptr<QuadraTranslator>> workers;
+	std::vector<std::unique_ptr<llvm::TargetMachine>> worker_target_machines;
+	for(unsigned int i = 1; i < jobs; i++) {
+		workers.push_back(pcode_to_llvm.create_worker());
+		worker_target_machines.push_back(create_host_target_machine(workers.back()->module(), optimizer_options.level));
+	}
+	std::vector<QuadraPassTimes> pass_times(jobs);
+	std::atomic<size_t> next_function = 0;
+	auto lower_functions = [&](QuadraTranslator* translator, llvm::TargetMachine* translator_target_machine, QuadraPassTimes* times) {
+		for(size_t i = next_function++; i < functions.size(); i = next_function++) {
+			translate_function(*translator, *functions[i], *arch.translate);
+		}
+		simplify_functions(translator->module(), translator_target_machine, optimizer_options, *times);
+	};
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < workers.size(); i++) {
+		threads.emplace_back(lower_functions, workers[i].get(), worker_target_machines[i].get(), &pass_times[i + 1]);
+	}
+	lower_functions(&pcode_to_llvm, target_machine.get(), &pass_times[0]);
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+	QuadraPassTimes simplify_times;
+	for(const QuadraPassTimes& times : pass_times) {
+		merge_pass_times(simplify_times, times);
+	}
+	pcode_to_llvm.link_workers(std::move(workers));
+	if(pcode_stats) {
+		pcode_to_llvm.pcode_stats().print();
+	}
+	
+	optimize_module(module, target_machine.get(), optimizer_options, simplify_times);
+	if(run) {
+		std::unique_ptr<llvm::Module> jit_module = pcode_to_llvm.take_module();
+		return run_jit(std::move(jit_module), pcode_to_llvm.take_context());
+	}
+	write_output(module, *target_machine, output_options);
+	
+	shutdownDecompilerLibrary(); // Does nothing.
+}
+
+void print_usage()
+{
+	printf("usage: GHIDRA_DIR=/path/to/ghidra ./quadra [options] /path/to/executable\n");
+	printf("options:\n");
+	printf("  --no-ssa          Go through memory for every register and temporary access.\n");
+	printf("  --no-pcode-opt    Only skip overwritten register writes, without folding or removing other pcode ops.\n");
+	printf("  --pcode-stats     Print how many pcode ops were removed by each pass.\n");
+	printf("  --all-symbols     Translate every function in the symbol table, even unreachable ones.\n");
+	printf("  -O0 to -O3        Optimize the translated code (default -O0).\n");
+	printf("  --fast-math       Assume there are no NaNs, infinities or denormals, like the R5900.\n");
+	printf("  --instrument      Count how often each block and call runs, see quadra_profile.\n");
+	printf("  --profile <path>  Optimize for the block counts from an instrumented run, or a text file.\n");
+	printf("  --time-passes     Print the time taken by each optimization pass.\n");
+	printf("  -o <path>         Write the output to a file instead of stdout.\n");
+	printf("  --emit <kind>     Output ll, bc, obj or exe (default: guessed from -o).\n");
+	printf("  --runtime <path>  Syscall library to link executables against.\n");
+	printf("  --run             Run the program in-process with a JIT.\n");
+	printf("  -j <threads>      Translate functions on this many threads (default: all cores).\n");
+	printf("  --partitions <n>  Split objects and executables into n modules and compile them in parallel.\n");
+	printf("  --cache <dir>     Reuse functions translated by previous runs from this directory.\n");
+	printf("  --stream <dir>    Write functions here as they're translated to save memory.\n");
+	exit(1);
+}
+
+void translate_function(QuadraTranslator& translator, const QuadraFunction& function, const Translate& translate)
+{
+	// The disassembly is printed in one go so that the output from different
+	// threads doesn't get mixed up.
+	std::stringstream disassembly;
+	Address address = function.ghidra->getAddress();
+	const BlockGraph* blocks = &function.ghidra->getBasicBlocks();
+	translator.begin_function(function);
+	
+	disassembly << function.llvm->getName().str() << "() {\n";
+	
+	for(const FlowBlock* block : blocks->getList()) {
+		const BlockBasic* basic = dynamic_cast<const BlockBasic*>(block);
+		assert(basic != nullptr); // We're not doing any control flow recovery, this should never happen.
 		
-		fprintf(stderr, "%s() {\n", function.llvm->getName().data());
+		char block_name[1024];
+		snprintf(block_name, 1024, "block_%lx", basic->getEntryAddr().getOffset() - address.getOffset());
+		disassembly << block_name << ":\n";
 		
-		for(const FlowBlock* block : blocks->getList()) {
-			const BlockBasic* basic = dynamic_cast<const BlockBasic*>(block);
-			assert(basic != nullptr); // We're not doing any control flow recovery, this should never happen.
-			
-			char block_name[1024];
-			snprintf(block_name, 1024, "block_%lx", basic->getEntryAddr().getOffset() - address.getOffset());
-			fprintf(stderr, "%s:\n", block_name);
+		llvm::Twine block_twine(block_name);
+		translator.begin_block(basic, block_twine);
+		Address last_address;
+		uintm first_time = 0;
+		for(auto iter = basic->beginOp(); iter != basic->endOp(); iter++) {
+			const PcodeOp& op = **iter;
 			
-			llvm::Twine block_twine(block_name);
-			pcode_to_llvm.begin_block(basic, block_twine);
-			Address last_address;
-			uintm first_time = 0;
-			for(auto iter = basic->beginOp(); iter != basic->endOp(); iter++) {
-				const PcodeOp& op = **iter;
-				
-				if(op.getAddr() != last_address) {
-					first_time = op.getTime();
-				}
-				last_address = op.getAddr();
-				
-				disassemble_pcodeop(*arch.translate, op.getTime() - first_time, op);
-				pcode_to_llvm.translate_pcodeop(op);
+			if(op.getAddr() != last_address) {
+				first_time = op.getTime();
 			}
-			pcode_to_llvm.end_block();
+			last_address = op.getAddr();
+			
+			disassemble_pcodeop(disassembly, translate, op.getTime() - first_time, op);
+			translator.translate_pcodeop(op);
 		}
-		
-		pcode_to_llvm.end_function();
-		
-		fprintf(stderr, "}\n");
+		translator.end_block();
 	}
 	
-	pcode_to_llvm.print();
+	translator.end_function();
 	
-	shutdownDecompilerLibrary(); // Does nothing.
+	disassembly << "}\n";
+	fputs(disassembly.str().c_str(), stderr);
 }
 
-void disassemble_pcodeop(const Translate& translate, size_t index, const PcodeOp& op)
+void disassemble_pcodeop(std::ostream& out, const Translate& translate, size_t index, const PcodeOp& op)
 {
-	fprintf(stderr, "\t %08lx:%04lx\t", op.getAddr().getOffset(), index);
+	char location[64];
+	snprintf(location, 64, "\t %08lx:%04lx\t", op.getAddr().getOffset(), index);
+	out << location;
 	if(op.getOut() != nullptr) {
-		print_vardata(translate, *op.getOut());
-		std::cerr << " = ";
+		print_vardata(out, translate, *op.getOut());
+		out << " = ";
 	}
-	std::cerr << get_opname(op.code());
+	out << get_opname(op.code());
 	for(int4 i = 0; i < op.numInput(); i++) {
-		std::cerr << ' ';
-		print_vardata(translate, *op.getIn(i));
+		out << ' ';
+		print_vardata(out, translate, *op.getIn(i));
 	}
-	std::cerr << endl;
+	out << endl;
 }
 
-void print_vardata(const Translate& translate, const Varnode& var)
+void print_vardata(std::ostream& out, const Translate& translate, const Varnode& var)
 {
 	if(var.getSpace()->getName() == "register") {
 		auto name = translate.getRegisterName(var.getSpace(), var.getOffset(), var.getSize());
 		if(name.size() > 0) {
-			std::cerr << name << ':' << var.getOffset() << ':' << var.getSize();
+			out << name << ':' << var.getOffset() << ':' << var.getSize();
 			return;
 		}
 	}
-	std::cerr << '(' << var.getSpace()->getName() << ',';
-	var.getSpace()->printOffset(std::cerr, var.getOffset());
-	std::cerr << ',' << dec << var.getSize() << ')';
+	out << '(' << var.getSpace()->getName() << ',';
+	var.getSpace()->printOffset(out, var.getOffset());
+	out << ',' << dec << var.getSize() << ')';
 }
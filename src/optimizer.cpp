@@ -0,0 +1,232 @@
+#include "optimizer.h"
+
+#include <chrono>
+#include <map>
+
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Records the wall time and instruction counts for each run of a pass. The
+// counts are for the IR unit the pass ran on, so they add up to the number
+// of instructions seen by the pass rather than the size of the module.
+class PassTimer {
+public:
+	PassTimer(QuadraPassTimes& stats) : _stats(stats) {}
+	
+	void register_callbacks(llvm::PassInstrumentationCallbacks& callbacks);
+	void print(size_t module_before, size_t module_after, double total_seconds);
+	
+private:
+	struct RunningPass {
+		Clock::time_point start;
+		size_t instructions;
+	};
+	
+	void finish(llvm::StringRef pass, size_t instructions);
+	
+	std::vector<RunningPass> _running;
+	QuadraPassTimes& _stats;
+};
+
+// The analysis managers used by a pass builder's pipelines.
+struct Analyses {
+	llvm::LoopAnalysisManager loop;
+	llvm::FunctionAnalysisManager function;
+	llvm::CGSCCAnalysisManager cgscc;
+	llvm::ModuleAnalysisManager module;
+	
+	void register_with(llvm::PassBuilder& pass_builder);
+};
+
+static size_t count_instructions(const llvm::Any& ir);
+static llvm::OptimizationLevel optimization_level(int level);
+
+void merge_pass_times(QuadraPassTimes& to, const QuadraPassTimes& from)
+{
+	for(auto& [name, stats] : from) {
+		QuadraPassStats& merged = to[name];
+		merged.runs += stats.runs;
+		merged.seconds += stats.seconds;
+		merged.instructions_before += stats.instructions_before;
+		merged.instructions_after += stats.instructions_after;
+	}
+}
+
+void optimize_module(llvm::Module& module, llvm::TargetMachine* target_machine, const QuadraOptimizerOptions& options, const QuadraPassTimes& earlier)
+{
+	if(llvm::verifyModule(module, &llvm::errs())) {
+		fprintf(stderr, "error: Translated module is broken, refusing to optimize it.\n");
+		exit(1);
+	}
+	
+	llvm::PassInstrumentationCallbacks callbacks;
+	QuadraPassTimes times = earlier;
+	PassTimer timer(times);
+	if(options.time_passes) {
+		timer.register_callbacks(callbacks);
+	}
+	
+	Analyses analyses;
+	llvm::PassBuilder pass_builder(target_machine, llvm::PipelineTuningOptions(), {}, &callbacks);
+	analyses.register_with(pass_builder);
+	
+	llvm::OptimizationLevel level = optimization_level(options.level);
+	llvm::ModulePassManager passes;
+	if(level == llvm::OptimizationLevel::O0) {
+		passes = pass_builder.buildO0DefaultPipeline(level);
+	} else {
+		passes = pass_builder.buildPerModuleDefaultPipeline(level);
+	}
+	
+	size_t instructions_before = module.getInstructionCount();
+	Clock::time_point start = Clock::now();
+	passes.run(module, analyses.module);
+	std::chrono::duration<double> total = Clock::now() - start;
+	
+	if(options.time_passes) {
+		timer.print(instructions_before, module.getInstructionCount(), total.count());
+	}
+}
+
+void simplify_functions(llvm::Module& module, llvm::TargetMachine* target_machine, const QuadraOptimizerOptions& options, QuadraPassTimes& times)
+{
+	llvm::OptimizationLevel level = optimization_level(options.level);
+	if(level == llvm::OptimizationLevel::O0) {
+		return;
+	}
+	
+	// The same data layout and target info as optimize_module, so functions
+	// come out the same no matter where they were simplified.
+	if(target_machine != nullptr) {
+		module.setDataLayout(target_machine->createDataLayout());
+	}
+	llvm::PassInstrumentationCallbacks callbacks;
+	PassTimer timer(times);
+	if(options.time_passes) {
+		timer.register_callbacks(callbacks);
+	}
+	Analyses analyses;
+	llvm::PassBuilder pass_builder(target_machine, llvm::PipelineTuningOptions(), {}, &callbacks);
+	analyses.function.registerPass([&] {
+		return target_machine != nullptr ? target_machine->getTargetIRAnalysis() : llvm::TargetIRAnalysis();
+	});
+	analyses.register_with(pass_builder);
+	
+	// buildPerModuleDefaultPipeline runs this pipeline again on each SCC
+	// after inlining. Running it here first is what lets that work be split
+	// across threads: the inliner then sees simplified functions, and the
+	// second run mostly finds nothing left to do.
+	llvm::ModulePassManager passes;
+	passes.addPass(llvm::createModuleToFunctionPassAdaptor(
+		pass_builder.buildFunctionSimplificationPipeline(level, llvm::ThinOrFullLTOPhase::None)));
+	passes.run(module, analyses.module);
+}
+
+void Analyses::register_with(llvm::PassBuilder& pass_builder)
+{
+	pass_builder.registerModuleAnalyses(module);
+	pass_builder.registerCGSCCAnalyses(cgscc);
+	pass_builder.registerFunctionAnalyses(function);
+	pass_builder.registerLoopAnalyses(loop);
+	pass_builder.crossRegisterProxies(loop, function, cgscc, module);
+}
+
+void PassTimer::register_callbacks(llvm::PassInstrumentationCallbacks& callbacks)
+{
+	callbacks.registerBeforeNonSkippedPassCallback([this](llvm::StringRef, llvm::Any ir) {
+		_running.push_back({Clock::now(), count_instructions(ir)});
+	});
+	callbacks.registerAfterPassCallback([this](llvm::StringRef pass, llvm::Any ir, const llvm::PreservedAnalyses&) {
+		finish(pass, count_instructions(ir));
+	});
+	// The IR unit may have been deleted, e.g. a function that was inlined
+	// everywhere, in which case there's nothing left to count.
+	callbacks.registerAfterPassInvalidatedCallback([this](llvm::StringRef pass, const llvm::PreservedAnalyses&) {
+		finish(pass, 0);
+	});
+}
+
+void PassTimer::finish(llvm::StringRef pass, size_t instructions)
+{
+	assert(!_running.empty());
+	RunningPass running = _running.back();
+	_running.pop_back();
+	std::chrono::duration<double> elapsed = Clock::now() - running.start;
+	
+	QuadraPassStats& stats = _stats[pass.str()];
+	stats.runs++;
+	stats.seconds += elapsed.count();
+	stats.instructions_before += running.instructions;
+	stats.instructions_after += instructions;
+	
+	// Don't count the time spent in nested passes twice.
+	for(RunningPass& parent : _running) {
+		parent.start += std::chrono::duration_cast<Clock::duration>(elapsed);
+	}
+}
+
+void PassTimer::print(size_t module_before, size_t module_after, double total_seconds)
+{
+	// Times from simplify_functions are summed over its threads, so the
+	// passes can add up to more than the total.
+	std::vector<std::pair<std::string, QuadraPassStats>> sorted(_stats.begin(), _stats.end());
+	std::sort(sorted.begin(), sorted.end(), [](auto& l, auto& r) {
+		return l.second.seconds > r.second.seconds;
+	});
+	
+	fprintf(stderr, "%10s %6s %12s %12s  %s\n", "time (s)", "runs", "insts before", "insts after", "pass");
+	for(auto& [name, stats] : sorted) {
+		fprintf(stderr, "%10.4f %6zu %12zu %12zu  %s\n",
+			stats.seconds, stats.runs, stats.instructions_before, stats.instructions_after, name.c_str());
+	}
+	fprintf(stderr, "%10.4f %6s %12zu %12zu  %s\n", total_seconds, "", module_before, module_after, "total");
+}
+
+static size_t count_instructions(const llvm::Any& ir)
+{
+	if(llvm::any_isa<const llvm::Module*>(ir)) {
+		const llvm::Module* module = llvm::any_cast<const llvm::Module*>(ir);
+		return module->getInstructionCount();
+	}
+	if(llvm::any_isa<const llvm::Function*>(ir)) {
+		const llvm::Function* function = llvm::any_cast<const llvm::Function*>(ir);
+		return function->getInstructionCount();
+	}
+	if(llvm::any_isa<const llvm::LazyCallGraph::SCC*>(ir)) {
+		const llvm::LazyCallGraph::SCC* scc = llvm::any_cast<const llvm::LazyCallGraph::SCC*>(ir);
+		size_t count = 0;
+		for(const llvm::LazyCallGraph::Node& node : *scc) {
+			count += node.getFunction().getInstructionCount();
+		}
+		return count;
+	}
+	if(llvm::any_isa<const llvm::Loop*>(ir)) {
+		const llvm::Loop* loop = llvm::any_cast<const llvm::Loop*>(ir);
+		size_t count = 0;
+		for(const llvm::BasicBlock* block : loop->blocks()) {
+			count += block->size();
+		}
+		return count;
+	}
+	return 0;
+}
+
+static llvm::OptimizationLevel optimization_level(int level)
+{
+	switch(level) {
+		case 0: return llvm::OptimizationLevel::O0;
+		case 1: return llvm::OptimizationLevel::O1;
+		case 2: return llvm::OptimizationLevel::O2;
+		case 3: return llvm::OptimizationLevel::O3;
+	}
+	fprintf(stderr, "error: Invalid optimization level %d.\n", level);
+	exit(1);
+}
@@ -0,0 +1,39 @@
+#ifndef _QUADRA_OPTIMIZER_H
+#define _QUADRA_OPTIMIZER_H
+
+#include <map>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+struct QuadraOptimizerOptions {
+	int level = 0; // 0 to 3, like -O0 to -O3.
+	bool time_passes = false; // Print the time taken by each pass and how it changed the instruction count.
+};
+
+struct QuadraPassStats {
+	size_t runs = 0;
+	double seconds = 0;
+	size_t instructions_before = 0;
+	size_t instructions_after = 0;
+};
+
+// Statistics for --time-passes, by pass name.
+using QuadraPassTimes = std::map<std::string, QuadraPassStats>;
+
+// Add the statistics in from to those in to.
+void merge_pass_times(QuadraPassTimes& to, const QuadraPassTimes& from);
+
+// Run the standard LLVM new pass manager pipeline for the given level over
+// the translated module. The target machine may be null. With time_passes,
+// the report includes the earlier times, e.g. from simplify_functions.
+void optimize_module(llvm::Module& module, llvm::TargetMachine* target_machine, const QuadraOptimizerOptions& options, const QuadraPassTimes& earlier = {});
+
+// Run just the per-function simplification passes over the functions defined
+// in a module, so that this part of the work can be split across threads.
+// Each thread needs its own target machine, which may be null, and its own
+// times, which are only filled in with time_passes.
+void simplify_functions(llvm::Module& module, llvm::TargetMachine* target_machine, const QuadraOptimizerOptions& options, QuadraPassTimes& times);
+
+#endif
@@ -0,0 +1,432 @@
+#include "pcode_optimizer.h"
+
+static bool overlaps(const Varnode* var, AddrSpace* space, uintb offset, int4 size);
+static bool overlaps(const Varnode* l, const Varnode* r);
+static bool same_varnode(const Varnode* l, const Varnode* r);
+static bool is_compare(OpCode code);
+static bool is_pure(OpCode code);
+static bool fold(const PcodeOp& op, const std::vector<uintb>& inputs, uintb& result);
+
+void PcodeStats::add(const PcodeStats& other)
+{
+	ops += other.ops;
+	folded += other.folded;
+	propagated += other.propagated;
+	dead_temporaries += other.dead_temporaries;
+	dead_registers += other.dead_registers;
+	fused_compares += other.fused_compares;
+}
+
+void PcodeStats::print() const
+{
+	size_t removed = folded + propagated + dead_temporaries + dead_registers;
+	fprintf(stderr, "%10s  %s\n", "pcode ops", "pass");
+	fprintf(stderr, "%10zu  %s\n", folded, "constant folding");
+	fprintf(stderr, "%10zu  %s\n", propagated, "copy propagation");
+	fprintf(stderr, "%10zu  %s\n", dead_temporaries, "dead temporaries");
+	fprintf(stderr, "%10zu  %s\n", dead_registers, "dead register writes");
+	fprintf(stderr, "%10zu  %s\n", fused_compares, "compares fused into branches");
+	fprintf(stderr, "%10zu  %s\n", removed, "removed in total");
+	fprintf(stderr, "%10zu  %s\n", ops - removed, "left to translate");
+}
+
+PcodeOptimizer::PcodeOptimizer(AddrSpace* register_space, AddrSpace* unique_space, std::set<uintb> syscall_userops)
+	: _register_space(register_space)
+	, _unique_space(unique_space)
+	, _syscall_userops(std::move(syscall_userops)) {}
+
+void PcodeOptimizer::begin_function(const Funcdata& function)
+{
+	// SLEIGH temporaries normally live within one instruction, but an
+	// instruction with internal control flow is split into several blocks.
+	_live_unique_bytes.clear();
+	for(const FlowBlock* block : function.getBasicBlocks().getList()) {
+		const BlockBasic* basic = dynamic_cast<const BlockBasic*>(block);
+		std::set<uintb> written;
+		for(auto iter = basic->beginOp(); iter != basic->endOp(); iter++) {
+			const PcodeOp* op = *iter;
+			for(int4 i = 0; i < op->numInput(); i++) {
+				const Varnode* in = op->getIn(i);
+				if(in->getSpace() != _unique_space) {
+					continue;
+				}
+				for(int4 j = 0; j < in->getSize(); j++) {
+					if(written.count(in->getOffset() + j) == 0) {
+						_live_unique_bytes.insert(in->getOffset() + j);
+					}
+				}
+			}
+			const Varnode* out = op->getOut();
+			if(out != nullptr && out->getSpace() == _unique_space) {
+				for(int4 i = 0; i < out->getSize(); i++) {
+					written.insert(out->getOffset() + i);
+				}
+			}
+		}
+	}
+}
+
+OptimizedBlock PcodeOptimizer::optimize(const BlockBasic* block)
+{
+	OptimizedBlock result;
+	std::set<const PcodeOp*> folded;
+	propagate(block, result, folded);
+	remove_dead_ops(block, result, true);
+	fuse_compare(block, result);
+	count(block, result, folded);
+	return result;
+}
+
+OptimizedBlock PcodeOptimizer::remove_dead_registers(const BlockBasic* block)
+{
+	OptimizedBlock result;
+	remove_dead_ops(block, result, false);
+	count(block, result, {});
+	return result;
+}
+
+void PcodeOptimizer::count(const BlockBasic* block, const OptimizedBlock& result, const std::set<const PcodeOp*>& folded)
+{
+	for(auto iter = block->beginOp(); iter != block->endOp(); iter++) {
+		stats.ops++;
+	}
+	for(const PcodeOp* op : result.dead) {
+		if(folded.count(op) == 1) {
+			stats.folded++;
+		} else if(op->code() == CPUI_COPY && op->getOut()->getSpace() == _unique_space) {
+			stats.propagated++;
+		} else if(op->getOut()->getSpace() == _register_space) {
+			stats.dead_registers++;
+		} else {
+			stats.dead_temporaries++;
+		}
+	}
+	if(result.fused_compare != nullptr) {
+		stats.fused_compares++;
+	}
+}
+
+void PcodeOptimizer::propagate(const BlockBasic* block, OptimizedBlock& result, std::set<const PcodeOp*>& folded)
+{
+	// The values of temporaries written by a COPY or computed from constants,
+	// which can be used in their place until what they refer to changes.
+	std::map<std::pair<uintb, int4>, PcodeValue> known;
+	for(auto iter = block->beginOp(); iter != block->endOp(); iter++) {
+		const PcodeOp* op = *iter;
+		std::vector<PcodeValue> values;
+		std::vector<uintb> constants;
+		for(int4 i = 0; i < op->numInput(); i++) {
+			const Varnode* in = op->getIn(i);
+			PcodeValue value;
+			auto known_iter = known.end();
+			if(in->getSpace() == _unique_space) {
+				known_iter = known.find({in->getOffset(), in->getSize()});
+			}
+			if(known_iter != known.end()) {
+				value = known_iter->second;
+				result.inputs[{op, i}] = value;
+			} else if(in->isConstant()) {
+				value.constant = in->getOffset();
+			} else {
+				value.var = in;
+			}
+			if(value.var == nullptr && in->getSize() <= 8) {
+				constants.push_back(value.constant);
+			}
+			values.push_back(value);
+		}
+
+		const Varnode* out = op->getOut();
+		for(auto known_iter = known.begin(); known_iter != known.end();) {
+			const PcodeValue& value = known_iter->second;
+			bool clobbered = false;
+			if(out != nullptr) {
+				auto [offset, size] = known_iter->first;
+				clobbered = overlaps(out, _unique_space, offset, size) || (value.var != nullptr && overlaps(value.var, out));
+			}
+			// Calls and stores can change anything other than temporaries.
+			if(value.var != nullptr && value.var->getSpace() != _unique_space
+					&& (is_barrier(*op) || op->code() == CPUI_STORE)) {
+				clobbered = true;
+			}
+			if(clobbered) {
+				known_iter = known.erase(known_iter);
+			} else {
+				known_iter++;
+			}
+		}
+
+		if(out == nullptr || out->getSpace() != _unique_space || out->getSize() > 8) {
+			continue;
+		}
+		uintb constant;
+		if(op->code() == CPUI_COPY && (values[0].var == nullptr || !overlaps(values[0].var, out))) {
+			known[{out->getOffset(), out->getSize()}] = values[0];
+			if(values[0].var == nullptr) {
+				folded.insert(op);
+			}
+		} else if(constants.size() == (size_t) op->numInput() && fold(*op, constants, constant)) {
+			PcodeValue value;
+			value.constant = constant;
+			known[{out->getOffset(), out->getSize()}] = value;
+			folded.insert(op);
+		}
+	}
+}
+
+void PcodeOptimizer::remove_dead_ops(const BlockBasic* block, OptimizedBlock& result, bool temporaries)
+{
+	// Walk the block backwards tracking which temporaries are read and which
+	// bytes of the register space are overwritten before they're read, and
+	// skip pure ops whose output is never used. x86 SLEIGH sets the flags
+	// after almost every arithmetic instruction, and most of them are
+	// overwritten by the next one. Registers are all live at the end of the
+	// block and across calls.
+	std::set<uintb> live_unique = _live_unique_bytes;
+	std::set<uintb> overwritten;
+	for(auto iter = block->endOp(); iter != block->beginOp();) {
+		const PcodeOp* op = *--iter;
+		if(is_barrier(*op)) {
+			overwritten.clear();
+		}
+
+		const Varnode* out = op->getOut();
+		if(out != nullptr && is_pure(op->code())) {
+			bool dead = false;
+			if(out->getSpace() == _unique_space && temporaries) {
+				dead = true;
+				for(int4 i = 0; i < out->getSize() && dead; i++) {
+					dead = live_unique.count(out->getOffset() + i) == 0;
+				}
+			} else if(out->getSpace() == _register_space) {
+				dead = true;
+				for(int4 i = 0; i < out->getSize() && dead; i++) {
+					dead = overwritten.count(out->getOffset() + i) == 1;
+				}
+			}
+			if(dead) {
+				result.dead.insert(op);
+				continue;
+			}
+		}
+		if(out != nullptr && out->getSpace() == _unique_space) {
+			for(int4 i = 0; i < out->getSize(); i++) {
+				live_unique.erase(out->getOffset() + i);
+			}
+		} else if(out != nullptr && out->getSpace() == _register_space) {
+			for(int4 i = 0; i < out->getSize(); i++) {
+				overwritten.insert(out->getOffset() + i);
+			}
+		}
+
+		for(int4 i = 0; i < op->numInput(); i++) {
+			const Varnode* in = input(result, *op, i);
+			if(in != nullptr && in->getSpace() == _unique_space) {
+				for(int4 j = 0; j < in->getSize(); j++) {
+					live_unique.insert(in->getOffset() + j);
+				}
+			} else if(in != nullptr && in->getSpace() == _register_space) {
+				for(int4 j = 0; j < in->getSize(); j++) {
+					overwritten.erase(in->getOffset() + j);
+				}
+			}
+		}
+	}
+}
+
+void PcodeOptimizer::fuse_compare(const BlockBasic* block, OptimizedBlock& result)
+{
+	// The condition has to reach the branch unchanged. A temporary can't be
+	// read by anything else either, since the compare then doesn't write it.
+	const PcodeOp* branch = block->lastOp();
+	if(branch == nullptr || branch->code() != CPUI_CBRANCH) {
+		return;
+	}
+	const Varnode* condition = input(result, *branch, 1);
+	if(condition == nullptr) {
+		return;
+	}
+	bool temporary = condition->getSpace() == _unique_space;
+	if(temporary) {
+		for(int4 i = 0; i < condition->getSize(); i++) {
+			if(_live_unique_bytes.count(condition->getOffset() + i) == 1) {
+				return;
+			}
+		}
+	} else if(condition->getSpace() != _register_space) {
+		return;
+	}
+
+	auto iter = block->endOp();
+	iter--;
+	while(iter != block->beginOp()) {
+		const PcodeOp* op = *--iter;
+		if(result.dead.count(op) == 1) {
+			continue;
+		}
+		const Varnode* out = op->getOut();
+		if(out != nullptr && overlaps(out, condition)) {
+			if(same_varnode(out, condition) && is_compare(op->code())) {
+				result.fused_compare = op;
+			}
+			return;
+		}
+		if(!temporary && is_barrier(*op)) {
+			return;
+		}
+		for(int4 i = 0; temporary && i < op->numInput(); i++) {
+			const Varnode* in = input(result, *op, i);
+			if(in != nullptr && overlaps(in, condition)) {
+				return;
+			}
+		}
+	}
+}
+
+bool PcodeOptimizer::is_barrier(const PcodeOp& op)
+{
+	switch(op.code()) {
+		case CPUI_CALL:
+		case CPUI_CALLIND:
+		case CPUI_RETURN:
+			return true;
+		case CPUI_CALLOTHER:
+			return _syscall_userops.count(op.getIn(0)->getOffset()) == 1;
+		default:
+			return false;
+	}
+}
+
+const Varnode* PcodeOptimizer::input(const OptimizedBlock& result, const PcodeOp& op, int4 slot)
+{
+	auto iter = result.inputs.find({&op, slot});
+	if(iter != result.inputs.end()) {
+		return iter->second.var;
+	}
+	return op.getIn(slot)->isConstant() ? nullptr : op.getIn(slot);
+}
+
+static bool overlaps(const Varnode* var, AddrSpace* space, uintb offset, int4 size)
+{
+	return var->getSpace() == space
+		&& var->getOffset() < offset + size
+		&& offset < var->getOffset() + var->getSize();
+}
+
+static bool overlaps(const Varnode* l, const Varnode* r)
+{
+	return overlaps(l, r->getSpace(), r->getOffset(), r->getSize());
+}
+
+static bool same_varnode(const Varnode* l, const Varnode* r)
+{
+	return l->getSpace() == r->getSpace() && l->getOffset() == r->getOffset() && l->getSize() == r->getSize();
+}
+
+static bool is_compare(OpCode code)
+{
+	switch(code) {
+		case CPUI_INT_EQUAL:
+		case CPUI_INT_NOTEQUAL:
+		case CPUI_INT_SLESS:
+		case CPUI_INT_SLESSEQUAL:
+		case CPUI_INT_LESS:
+		case CPUI_INT_LESSEQUAL:
+		case CPUI_BOOL_NEGATE:
+		case CPUI_FLOAT_EQUAL:
+		case CPUI_FLOAT_NOTEQUAL:
+		case CPUI_FLOAT_LESS:
+		case CPUI_FLOAT_LESSEQUAL:
+		case CPUI_FLOAT_NAN:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_pure(OpCode code)
+{
+	// Loads are kept since they may fault, and so are divisions, which trap
+	// on a zero divisor.
+	switch(code) {
+		case CPUI_INT_DIV:
+		case CPUI_INT_SDIV:
+		case CPUI_INT_REM:
+		case CPUI_INT_SREM:
+		case CPUI_LOAD:
+		case CPUI_STORE:
+		case CPUI_BRANCH:
+		case CPUI_CBRANCH:
+		case CPUI_BRANCHIND:
+		case CPUI_CALL:
+		case CPUI_CALLIND:
+		case CPUI_CALLOTHER:
+		case CPUI_RETURN:
+			return false;
+		default:
+			return true;
+	}
+}
+
+static uintb size_mask(int4 size)
+{
+	return size >= 8 ? ~(uintb) 0 : ((uintb) 1 << (size * 8)) - 1;
+}
+
+static intb sign_extend(uintb value, int4 size)
+{
+	if(size >= 8) {
+		return (intb) value;
+	}
+	uintb sign = (uintb) 1 << (size * 8 - 1);
+	return (intb) (((value & size_mask(size)) ^ sign) - sign);
+}
+
+// Evaluate an op on constant inputs, following the semantics in the SLEIGH
+// documentation. Returns false for ops that aren't folded.
+static bool fold(const PcodeOp& op, const std::vector<uintb>& inputs, uintb& result)
+{
+	int4 size = op.getOut()->getSize();
+	int4 in_size = op.getIn(0)->getSize();
+	int4 bits = in_size * 8;
+	uintb a = inputs[0];
+	uintb b = inputs.size() > 1 ? inputs[1] : 0;
+	switch(op.code()) {
+		case CPUI_INT_ZEXT: result = a; break;
+		case CPUI_INT_SEXT: result = sign_extend(a, in_size); break;
+		case CPUI_INT_ADD: result = a + b; break;
+		case CPUI_INT_SUB: result = a - b; break;
+		case CPUI_INT_MULT: result = a * b; break;
+		case CPUI_INT_AND: result = a & b; break;
+		case CPUI_INT_OR: result = a | b; break;
+		case CPUI_INT_XOR: result = a ^ b; break;
+		case CPUI_INT_NEGATE: result = ~a; break;
+		case CPUI_INT_2COMP: result = -a; break;
+		case CPUI_INT_LEFT: result = b >= (uintb) bits ? 0 : a << b; break;
+		case CPUI_INT_RIGHT: result = b >= (uintb) bits ? 0 : (a & size_mask(in_size)) >> b; break;
+		case CPUI_INT_SRIGHT:
+			result = sign_extend(a, in_size) >> (b >= (uintb) bits ? bits - 1 : b);
+			break;
+		case CPUI_INT_EQUAL: result = a == b; break;
+		case CPUI_INT_NOTEQUAL: result = a != b; break;
+		case CPUI_INT_LESS: result = a < b; break;
+		case CPUI_INT_LESSEQUAL: result = a <= b; break;
+		case CPUI_INT_SLESS: result = sign_extend(a, in_size) < sign_extend(b, in_size); break;
+		case CPUI_INT_SLESSEQUAL: result = sign_extend(a, in_size) <= sign_extend(b, in_size); break;
+		case CPUI_BOOL_NEGATE: result = a == 0; break;
+		case CPUI_BOOL_AND: result = a & b; break;
+		case CPUI_BOOL_OR: result = a | b; break;
+		case CPUI_BOOL_XOR: result = a ^ b; break;
+		case CPUI_SUBPIECE: result = b >= 8 ? 0 : a >> (b * 8); break;
+		case CPUI_PIECE:
+			if(size > 8) {
+				return false;
+			}
+			result = (a << (op.getIn(1)->getSize() * 8)) | b;
+			break;
+		default:
+			return false;
+	}
+	result &= size_mask(size);
+	return true;
+}
@@ -0,0 +1,72 @@
+#ifndef _QUADRA_PCODE_OPTIMIZER_H
+#define _QUADRA_PCODE_OPTIMIZER_H
+
+#include <decompile/cpp/funcdata.hh>
+
+#include <map>
+#include <set>
+
+// What an input of a pcode op is read as instead of its own varnode, either a
+// constant or another varnode that holds the same value.
+struct PcodeValue {
+	const Varnode* var = nullptr; // Null for a constant.
+	uintb constant = 0;
+};
+
+// The result of optimizing a basic block. Ghidra's ops are left as they are,
+// and the translator applies this as it goes.
+struct OptimizedBlock {
+	std::set<const PcodeOp*> dead; // Ops that don't need translating.
+	std::map<std::pair<const PcodeOp*, int4>, PcodeValue> inputs; // Replacements for op inputs.
+
+	// A compare whose result is only used by the CBRANCH at the end of the
+	// block, which can then branch on it without widening it to a byte.
+	const PcodeOp* fused_compare = nullptr;
+};
+
+// How many ops each pass got rid of.
+struct PcodeStats {
+	size_t ops = 0;
+	size_t folded = 0; // Constants folded into their uses.
+	size_t propagated = 0; // Copies to temporaries propagated into their uses.
+	size_t dead_temporaries = 0;
+	size_t dead_registers = 0; // Register writes overwritten before being read.
+	size_t fused_compares = 0;
+
+	void add(const PcodeStats& other);
+	void print() const;
+};
+
+// Cleans up raw pcode before it's translated, so that LLVM has less IR to
+// chew through. Each block is handled on its own, with constant folding and
+// copy propagation through the unique space followed by dead store
+// elimination. Temporaries that are read by other blocks of the function are
+// kept alive.
+class PcodeOptimizer {
+public:
+	// Syscalls are user-ops that read and write registers behind the scenes.
+	PcodeOptimizer(AddrSpace* register_space, AddrSpace* unique_space, std::set<uintb> syscall_userops);
+
+	void begin_function(const Funcdata& function);
+	OptimizedBlock optimize(const BlockBasic* block);
+	// Only skip register writes that are overwritten before they're read,
+	// which is done even with the rest of the optimizer turned off.
+	OptimizedBlock remove_dead_registers(const BlockBasic* block);
+
+	PcodeStats stats;
+
+private:
+	void propagate(const BlockBasic* block, OptimizedBlock& result, std::set<const PcodeOp*>& folded);
+	void remove_dead_ops(const BlockBasic* block, OptimizedBlock& result, bool temporaries);
+	void count(const BlockBasic* block, const OptimizedBlock& result, const std::set<const PcodeOp*>& folded);
+	void fuse_compare(const BlockBasic* block, OptimizedBlock& result);
+	bool is_barrier(const PcodeOp& op); // Ops that may read or write any register.
+	const Varnode* input(const OptimizedBlock& result, const PcodeOp& op, int4 slot); // Null if it's been replaced with a constant.
+
+	AddrSpace* _register_space;
+	AddrSpace* _unique_space;
+	std::set<uintb> _syscall_userops;
+	std::set<uintb> _live_unique_bytes; // Read in a block before being written in it.
+};
+
+#endif
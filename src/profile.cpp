@@ -0,0 +1,113 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "runtime.h"
+
+template <typename T>
+static bool read_value(FILE* file, T& value);
+
+QuadraProfile::QuadraProfile(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == nullptr) {
+		fprintf(stderr, "error: Failed to open profile %s.\n", path.c_str());
+		exit(1);
+	}
+	char magic[4];
+	bool instrumented = fread(magic, sizeof(magic), 1, file) == 1
+		&& memcmp(magic, QUADRA_PROFILE_MAGIC, sizeof(magic)) == 0;
+	if(!instrumented) {
+		rewind(file);
+	}
+	bool ok = instrumented ? read_instrumented(file) : read_text(file);
+	fclose(file);
+	if(!ok) {
+		fprintf(stderr, "error: Profile %s is malformed.\n", path.c_str());
+		exit(1);
+	}
+}
+
+uint64_t QuadraProfile::count(uint64_t begin, uint64_t end) const
+{
+	uint64_t result = 0;
+	for(auto iter = _counts.lower_bound(begin); iter != _counts.end() && iter->first <= end; iter++) {
+		result = std::max(result, iter->second);
+	}
+	return result;
+}
+
+const std::map<uint64_t, uint64_t>& QuadraProfile::counts() const
+{
+	return _counts;
+}
+
+bool QuadraProfile::read_instrumented(FILE* file)
+{
+	// Calls are counted too, but each callee's entry block already says how
+	// often it was called.
+	uint32_t version;
+	uint64_t function_count;
+	if(!read_value(file, version) || version != QUADRA_PROFILE_VERSION || !read_value(file, function_count)) {
+		return false;
+	}
+	for(uint64_t i = 0; i < function_count; i++) {
+		uint64_t address;
+		uint32_t name_size;
+		uint64_t counter_count;
+		if(!read_value(file, address) || !read_value(file, name_size) || fseek(file, name_size, SEEK_CUR) != 0) {
+			return false;
+		}
+		if(!read_value(file, counter_count)) {
+			return false;
+		}
+		for(uint64_t j = 0; j < counter_count; j++) {
+			uint8_t kind;
+			uint64_t counter_address;
+			uint64_t target;
+			uint64_t count;
+			if(!read_value(file, kind) || !read_value(file, counter_address) || !read_value(file, target) || !read_value(file, count)) {
+				return false;
+			}
+			if(kind == QUADRA_COUNTER_BLOCK) {
+				_counts[counter_address] += count;
+			}
+		}
+	}
+	return true;
+}
+
+bool QuadraProfile::read_text(FILE* file)
+{
+	char line[256];
+	while(fgets(line, sizeof(line), file) != nullptr) {
+		char* cursor = line;
+		while(*cursor == ' ' || *cursor == '\t') {
+			cursor++;
+		}
+		if(*cursor == '#' || *cursor == '\n' || *cursor == '\0') {
+			continue;
+		}
+		char* end;
+		uint64_t address = strtoull(cursor, &end, 16);
+		if(end == cursor) {
+			return false;
+		}
+		cursor = end;
+		uint64_t count = strtoull(cursor, &end, 10);
+		if(end == cursor) {
+			return false;
+		}
+		_counts[address] += count;
+	}
+	return !ferror(file);
+}
+
+template <typename T>
+static bool read_value(FILE* file, T& value)
+{
+	return fread(&value, sizeof(value), 1, file) == 1;
+}
@@ -0,0 +1,29 @@
+#ifndef _QUADRA_PROFILE_H
+#define _QUADRA_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// How many times guest code ran, used to guide translation. Either written by
+// a program translated with --instrument, see runtime.h for the format, or a
+// text file with a hex guest address and a count on each line, e.g. from a
+// sampling profiler. Lines starting with # are ignored.
+class QuadraProfile {
+public:
+	QuadraProfile(const std::string& path); // Exits if the profile can't be read.
+
+	// The highest count of any address in [begin, end]. For an instrumented
+	// profile that's the count of the block starting at begin.
+	uint64_t count(uint64_t begin, uint64_t end) const;
+
+	const std::map<uint64_t, uint64_t>& counts() const;
+
+private:
+	bool read_instrumented(FILE* file);
+	bool read_text(FILE* file);
+
+	std::map<uint64_t, uint64_t> _counts; // By guest address.
+};
+
+#endif
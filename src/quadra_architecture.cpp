@@ -20,6 +20,15 @@ std::string QuadraArchitecture::return_register()
 	assert(0);
 }
 
+std::string QuadraArchitecture::stack_pointer_register()
+{
+	switch(((ElfLoader*) loader)->machine()) {
+		case ElfMachine::MIPS: return { "sp" };
+		case ElfMachine::AMD64: return { "RSP" };
+	}
+	assert(0);
+}
+
 std::vector<std::string> QuadraArchitecture::syscall_argument_registers()
 {
 	switch(((ElfLoader*) loader)->machine()) {
@@ -46,13 +55,91 @@ std::map<int, SyscallInfo> QuadraArchitecture::syscalls()
 			{4003, {"qsys_read", PT_U32, {PT_U32, PT_CHAR_PTR, PT_U32}}},
 			{4004, {"qsys_write", PT_U32, {PT_U32, PT_CHAR_PTR, PT_U32}}},
 			{4005, {"qsys_open", PT_U32, {PT_CHAR_PTR, PT_U32, PT_U32}}},
-			{4006, {"qsys_close", PT_U32, {PT_U32}}}
+			{4006, {"qsys_close", PT_U32, {PT_U32}}},
+			{4045, {"qsys_brk", PT_U32, {PT_U32}}}
 		};
 		case ElfMachine::AMD64: return {};
 	}
 	assert(0);
 }
 
+std::string QuadraArchitecture::syscall_userop()
+{
+	return "syscall";
+}
+
+std::map<std::string, VectorUserOpInfo> QuadraArchitecture::vector_userops()
+{
+	switch(((ElfLoader*) loader)->machine()) {
+		case ElfMachine::MIPS: return {
+			// R5900 multimedia instructions, on 128-bit registers. The multiply
+			// instructions, like pmaddw and phmadh, also write HI and LO, which
+			// a user-op with one output can't express, so they aren't lowered.
+			{"paddw", {VectorOp::ADD, 32}},
+			{"paddh", {VectorOp::ADD, 16}},
+			{"paddb", {VectorOp::ADD, 8}},
+			{"psubw", {VectorOp::SUB, 32}},
+			{"psubh", {VectorOp::SUB, 16}},
+			{"psubb", {VectorOp::SUB, 8}},
+			{"paddsw", {VectorOp::ADD_SAT, 32}},
+			{"paddsh", {VectorOp::ADD_SAT, 16}},
+			{"paddsb", {VectorOp::ADD_SAT, 8}},
+			{"padduw", {VectorOp::ADD_USAT, 32}},
+			{"padduh", {VectorOp::ADD_USAT, 16}},
+			{"paddub", {VectorOp::ADD_USAT, 8}},
+			{"psubsw", {VectorOp::SUB_SAT, 32}},
+			{"psubsh", {VectorOp::SUB_SAT, 16}},
+			{"psubsb", {VectorOp::SUB_SAT, 8}},
+			{"psubuw", {VectorOp::SUB_USAT, 32}},
+			{"psubuh", {VectorOp::SUB_USAT, 16}},
+			{"psubub", {VectorOp::SUB_USAT, 8}},
+			{"pmaxw", {VectorOp::MAX, 32}},
+			{"pmaxh", {VectorOp::MAX, 16}},
+			{"pminw", {VectorOp::MIN, 32}},
+			{"pminh", {VectorOp::MIN, 16}},
+			{"pabsw", {VectorOp::ABS_SAT, 32}},
+			{"pabsh", {VectorOp::ABS_SAT, 16}},
+			{"pceqw", {VectorOp::EQUAL, 32}},
+			{"pceqh", {VectorOp::EQUAL, 16}},
+			{"pceqb", {VectorOp::EQUAL, 8}},
+			{"pcgtw", {VectorOp::GREATER, 32}},
+			{"pcgth", {VectorOp::GREATER, 16}},
+			{"pcgtb", {VectorOp::GREATER, 8}},
+			{"pand", {VectorOp::AND, 64}},
+			{"por", {VectorOp::OR, 64}},
+			{"pxor", {VectorOp::XOR, 64}},
+			{"pnor", {VectorOp::NOR, 64}}
+		};
+		case ElfMachine::AMD64: return {
+			// MMX and SSE instructions that SLEIGH leaves as user-ops.
+			{"pavgb", {VectorOp::UAVG, 8}},
+			{"pavgw", {VectorOp::UAVG, 16}},
+			{"pmulhw", {VectorOp::MULHI, 16}},
+			{"pmulhuw", {VectorOp::UMULHI, 16}},
+			{"pmaddwd", {VectorOp::MADD_PAIRS, 16}},
+			{"pminsw", {VectorOp::MIN, 16}},
+			{"pmaxsw", {VectorOp::MAX, 16}},
+			{"pminub", {VectorOp::UMIN, 8}},
+			{"pmaxub", {VectorOp::UMAX, 8}},
+			{"paddsb", {VectorOp::ADD_SAT, 8}},
+			{"paddsw", {VectorOp::ADD_SAT, 16}},
+			{"paddusb", {VectorOp::ADD_USAT, 8}},
+			{"paddusw", {VectorOp::ADD_USAT, 16}},
+			{"psubsb", {VectorOp::SUB_SAT, 8}},
+			{"psubsw", {VectorOp::SUB_SAT, 16}},
+			{"psubusb", {VectorOp::SUB_USAT, 8}},
+			{"psubusw", {VectorOp::SUB_USAT, 16}},
+			{"minps", {VectorOp::FMIN, 32, true}},
+			{"maxps", {VectorOp::FMAX, 32, true}},
+			{"minpd", {VectorOp::FMIN, 64, true}},
+			{"maxpd", {VectorOp::FMAX, 64, true}},
+			{"sqrtps", {VectorOp::FSQRT, 32, true}},
+			{"sqrtpd", {VectorOp::FSQRT, 64, true}}
+		};
+	}
+	assert(0);
+}
+
 void QuadraArchitecture::buildLoader(DocumentStorage& store)
 {
 	collectSpecFiles(std::cerr);
@@ -13,6 +13,30 @@ struct SyscallInfo {
 	std::vector<PrimtiveType> argument_types;
 };
 
+// Lane-wise operations that SIMD user-ops are lowered to. Binary unless
+// noted otherwise.
+enum class VectorOp {
+	ADD, SUB,
+	ADD_SAT, ADD_USAT, SUB_SAT, SUB_USAT, // Saturating, signed and unsigned.
+	MIN, MAX, UMIN, UMAX,
+	ABS_SAT, // Unary, abs(INT_MIN) is INT_MAX.
+	AND, OR, XOR, NOR,
+	EQUAL, GREATER, // All ones in lanes where true. Signed.
+	UAVG, // Rounded up unsigned average.
+	MULHI, UMULHI, // High half of the product.
+	MADD_PAIRS, // Signed widening multiply, then add adjacent pairs of products.
+	FMIN, FMAX, // x86 semantics, the second operand if either is NaN.
+	FSQRT // Unary.
+};
+
+// A SIMD user-op. The number of lanes follows from the operand size, so
+// that e.g. the MMX and SSE forms of an x86 instruction share an entry.
+struct VectorUserOpInfo {
+	VectorOp op;
+	int lane_bits;
+	bool floating = false;
+};
+
 class QuadraArchitecture : public SleighArchitecture {
 public:
 	QuadraArchitecture(
@@ -21,10 +45,13 @@ public:
 		std::ostream* estream);
 	
 	std::string return_register();
+	std::string stack_pointer_register();
 	std::vector<std::string> syscall_argument_registers();
 	std::string syscall_return_register();
 
 	std::map<int, SyscallInfo> syscalls();
+	std::string syscall_userop();
+	std::map<std::string, VectorUserOpInfo> vector_userops(); // Keyed by user-op name.
 
 private:
 	void buildLoader(DocumentStorage& store) override;
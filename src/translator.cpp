@@ -1,29 +1,105 @@
 #include "translator.h"
 
 #include <decompile/cpp/funcdata.hh>
+#include <decompile/cpp/jumptable.hh>
 
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h> // llvm::outs
+#include <llvm/Linker/Linker.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/KnownBits.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <filesystem>
+#include <mutex>
 
 #include "elf_loader.h"
+#include "runtime.h"
+
+namespace fs = std::filesystem;
+
+static VarnodeData varnode_to_varnodedata(const Varnode* var);
+static bool merge_registers(std::vector<bool>& dest, const std::vector<bool>& src);
+static std::vector<bool> touched_registers(const RegisterSummary& summary);
+static void hash_u64(llvm::MD5& hash, uint64_t value);
+static void hash_bits(llvm::MD5& hash, const std::vector<bool>& bits);
+static void collect_globals(llvm::Value* value, std::set<llvm::GlobalValue*>& globals);
+static std::string extract_functions(llvm::ArrayRef<llvm::Function*> functions);
+
+// Bump this whenever a change to the translator changes its output.
+static const uint64_t CACHE_VERSION = 20;
 
-QuadraTranslator::QuadraTranslator(QuadraArchitecture* arch)
+// Ghidra isn't thread safe. Workers only read their functions' pcode, but
+// clearing a function also updates its scope in the symbol table.
+static std::mutex ghidra_mutex;
+
+QuadraTranslator::QuadraTranslator(QuadraArchitecture* arch, QuadraTranslatorOptions options)
+	: QuadraTranslator(arch, options, nullptr) {}
+
+QuadraTranslator::QuadraTranslator(QuadraArchitecture* arch, QuadraTranslatorOptions options, const QuadraTranslator* parent)
 	: _arch(arch)
-	, _module("quadra", _context)
-	, _builder(_context)
+	, _options(options)
+	, _parent(parent)
+	, _context(std::make_unique<llvm::LLVMContext>())
+	, _module(std::make_unique<llvm::Module>("quadra", *_context))
+	, _builder(*_context)
 {
+	_flat_memory = ((ElfLoader*) _arch->loader)->is_32_bit();
+	if(_flat_memory) {
+		_memory_base_global = new llvm::GlobalVariable(
+			*_module,
+			llvm::Type::getInt8PtrTy(*_context),
+			false,
+			llvm::GlobalValue::ExternalLinkage,
+			nullptr,
+			"__quadra_memory_base");
+	}
+	
+	_ghidra_register_space = _arch->getSpaceByName("register");
+	create_userop_table();
+	std::set<uintb> syscall_userops;
+	for(auto& [index, userop] : _userops) {
+		if(userop.kind == UserOpKind::SYSCALL) {
+			syscall_userops.insert(index);
+		}
+	}
+	_pcode_optimizer = std::make_unique<PcodeOptimizer>(_ghidra_register_space, _arch->getUniqueSpace(), syscall_userops);
 	std::map<VarnodeData, std::string> registers;
 	_arch->translate->getAllRegisters(registers);
 	for(auto& [varnode, _] : registers) {
-		if(varnode.space->getName() == "register") {
+		if(varnode.space == _ghidra_register_space) {
 			_register_space_size = std::max(_register_space_size, varnode.offset + varnode.size);
 		}
 	}
+	create_register_slots(registers);
+	
+	if(_options.ssa) {
+		// The syscall dispatcher reads the syscall number and its arguments,
+		// and writes the result back over the number.
+		_syscall_registers.read.assign(_register_slots.size(), false);
+		_syscall_registers.written.assign(_register_slots.size(), false);
+		size_t result = register_slot(_arch->translate->getRegister(_arch->syscall_return_register()));
+		_syscall_registers.read[result] = true;
+		_syscall_registers.written[result] = true;
+		for(auto& name : _arch->syscall_argument_registers()) {
+			_syscall_registers.read[register_slot(_arch->translate->getRegister(name))] = true;
+		}
+		_indirect_registers.read.assign(_register_slots.size(), false);
+		_indirect_registers.written.assign(_register_slots.size(), false);
+	}
 	
 	if(STORE_REGISTERS_IN_GLOBAL) {
 		auto registers_type = llvm::ArrayType::get(int_type(1), _register_space_size);
 		llvm::GlobalVariable* registers_global = new llvm::GlobalVariable(
-			_module,
+			*_module,
 			registers_type,
 			false,
 			llvm::GlobalValue::CommonLinkage,
@@ -33,17 +109,315 @@ QuadraTranslator::QuadraTranslator(QuadraArchitecture* arch)
 		auto register_ptr_type = llvm::PointerType::get(int_type(1), _register_space);
 		_registers_global = _builder.CreatePointerCast(registers_global, register_ptr_type, "");
 		
-		_syscall_dispatcher = create_syscall_dispatcher();
+		if(_parent == nullptr) {
+			_syscall_dispatcher = create_syscall_dispatcher();
+		} else {
+			llvm::FunctionType* dispatcher_type = llvm::FunctionType::get(int_type(4), false);
+			_syscall_dispatcher = llvm::Function::Create(
+				dispatcher_type, llvm::Function::ExternalLinkage, "__quadra_dispatch_syscall", *_module);
+		}
+	}
+	
+	create_segment_globals();
+	if(_parent == nullptr) {
+		create_segment_table();
+		
+		// The host entry point is declared before any guest function is
+		// discovered, so that a guest main can't take its name. Its body is
+		// filled in by create_main.
+		llvm::FunctionType* main_type = llvm::FunctionType::get(int_type(4), false);
+		_main = llvm::Function::Create(main_type, llvm::Function::ExternalLinkage, "main", *_module);
+		assert(_main->getName() == "main");
+	}
+	
+	if(_options.fast_math) {
+		llvm::FastMathFlags flags;
+		flags.setNoNaNs();
+		flags.setNoInfs();
+		_builder.setFastMathFlags(flags);
+	}
+	
+	if(_parent != nullptr) {
+		_profile = _parent->_profile;
+	} else if(!_options.profile_path.empty()) {
+		_profile = std::make_shared<QuadraProfile>(_options.profile_path);
+	}
+	
+	if(_parent != nullptr) {
+		_cache = _parent->_cache;
+	} else if(!_options.cache_directory.empty()) {
+		_cache = std::make_shared<QuadraCache>(_options.cache_directory);
+		
+		// Translated code refers to guest addresses directly and to segments
+		// by name, so the layout of the binary is part of every key.
+		llvm::MD5 hash;
+		hash_u64(hash, CACHE_VERSION);
+		hash.update(LLVM_VERSION_STRING);
+		hash.update(_arch->loader->getArchType());
+		hash_u64(hash, _options.ssa);
+		hash_u64(hash, _options.fast_math);
+		hash_u64(hash, _options.optimize_pcode);
+		hash_u64(hash, _options.instrument);
+		if(_profile != nullptr) {
+			// Any change to the profile invalidates everything, since the
+			// weights of one function could depend on any part of it.
+			for(auto& [address, count] : _profile->counts()) {
+				hash_u64(hash, address);
+				hash_u64(hash, count);
+			}
+		}
+		hash_u64(hash, STORE_REGISTERS_IN_GLOBAL);
+		for(const ElfProgramHeader64* header : ((ElfLoader*) _arch->loader)->load_segments()) {
+			hash_u64(hash, header->vaddr);
+			hash_u64(hash, header->filesz);
+			hash_u64(hash, header->memsz);
+			hash_u64(hash, header->flags);
+		}
+		llvm::MD5::MD5Result result;
+		hash.final(result);
+		_cache_salt = result.digest().str().str();
+	}
+	
+	if(_parent == nullptr && !_options.stream_directory.empty()) {
+		std::error_code error;
+		fs::create_directories(_options.stream_directory, error);
+		if(error) {
+			fprintf(stderr, "error: Failed to create stream directory %s: %s\n", _options.stream_directory.c_str(), error.message().c_str());
+			exit(1);
+		}
+	}
+}
+
+std::unique_ptr<QuadraTranslator> QuadraTranslator::create_worker()
+{
+	// Workers look up the summaries without taking any locks.
+	if(_options.ssa) {
+		update_register_summaries();
+		declare_bodies();
+	}
+	std::unique_ptr<QuadraTranslator> worker(new QuadraTranslator(_arch, _options, this));
+	worker->_indirect_registers = _indirect_registers;
+	
+	// Declare everything up front, so workers never have to touch the
+	// parent's LLVM objects from another thread.
+	for(auto& [address, function] : discovered_functions) {
+		QuadraFunction& imported = worker->_imported_functions[address];
+		imported.ghidra = function.ghidra;
+		imported.size = function.size;
+		imported.callees = function.callees;
+		imported.calls_indirectly = function.calls_indirectly;
+		imported.local_registers = function.local_registers;
+		imported.registers = function.registers;
+		imported.cache_key = function.cache_key;
+		llvm::FunctionType* type = llvm::FunctionType::get(llvm::Type::getInt64Ty(*worker->_context), false);
+		imported.llvm = llvm::Function::Create(type, llvm::Function::ExternalLinkage, function.llvm->getName(), *worker->_module);
+		if(function.body != nullptr) {
+			imported.body = llvm::Function::Create(
+				worker->body_type(function.registers), llvm::Function::ExternalLinkage, function.body->getName(), *worker->_module);
+			imported.body->setCallingConv(llvm::CallingConv::Fast);
+		}
+	}
+	return worker;
+}
+
+void QuadraTranslator::link_workers(std::vector<std::unique_ptr<QuadraTranslator>> workers)
+{
+	std::vector<std::string> function_order = function_names();
+	
+	// The worker modules live in other contexts, so they're moved over as
+	// bitcode. Use list order is kept so the output is the same as if the
+	// functions had been translated here.
+	for(std::unique_ptr<QuadraTranslator>& worker : workers) {
+		llvm::SmallVector<char, 0> buffer;
+		llvm::raw_svector_ostream stream(buffer);
+		llvm::WriteBitcodeToFile(*worker->_module, stream, true);
+		_pcode_optimizer->stats.add(worker->_pcode_optimizer->stats);
+		worker.reset();
+		
+		llvm::MemoryBufferRef buffer_ref(llvm::StringRef(buffer.data(), buffer.size()), "worker");
+		llvm::Expected<std::unique_ptr<llvm::Module>> module = llvm::parseBitcodeFile(buffer_ref, *_context);
+		if(!module) {
+			fprintf(stderr, "error: Failed to read back a worker's module: %s\n", llvm::toString(module.takeError()).c_str());
+			exit(1);
+		}
+		link_module(std::move(*module));
+	}
+	if(!_options.stream_directory.empty()) {
+		link_streamed_functions();
+	}
+	
+	// Put everything in an order that doesn't depend on which worker
+	// translated which function, or on how many workers there were.
+	restore_functions(function_order);
+	if(_profile != nullptr) {
+		set_profile_summary();
+	}
+	if(_options.instrument) {
+		create_profile_table();
+	}
+	
+	// Translated functions and segments aren't exported, so that guest
+	// symbols such as write or memcpy can't collide with the host C library
+	// at link time.
+	for(auto& [_, function] : discovered_functions) {
+		function.llvm->setLinkage(llvm::GlobalValue::InternalLinkage);
+		if(function.body != nullptr) {
+			function.body->setLinkage(llvm::GlobalValue::InternalLinkage);
+		}
+	}
+	for(QuadraSegment& segment : _segments) {
+		segment.global->setLinkage(llvm::GlobalValue::InternalLinkage);
+	}
+	function_finder()->setLinkage(llvm::GlobalValue::InternalLinkage);
+	
+	std::vector<llvm::GlobalVariable*> globals;
+	for(llvm::GlobalVariable& global : _module->globals()) {
+		globals.push_back(&global);
+	}
+	std::sort(globals.begin(), globals.end(), [](llvm::GlobalVariable* l, llvm::GlobalVariable* r) {
+		return l->getName() < r->getName();
+	});
+	for(llvm::GlobalVariable* global : globals) {
+		global->removeFromParent();
+		_module->getGlobalList().push_back(global);
+	}
+}
+
+void QuadraTranslator::load_cached_functions()
+{
+	if(_cache == nullptr) {
+		return;
+	}
+	if(_options.ssa) {
+		update_register_summaries();
+		declare_bodies();
+	}
+	
+	std::vector<std::string> function_order = function_names();
+	for(auto& [address, function] : discovered_functions) {
+		if(!function.cached) {
+			continue;
+		}
+		
+		// Entries that were translated against a callee with a different name
+		// or register summary are stale, as are unreadable ones.
+		const CachedFunction& cached = _cached_functions.at(address);
+		std::unique_ptr<llvm::Module> module;
+		if(cache_dependencies(function) == cached.dependencies) {
+			llvm::MemoryBufferRef buffer_ref(cached.bitcode, "cache");
+			llvm::Expected<std::unique_ptr<llvm::Module>> parsed = llvm::parseBitcodeFile(buffer_ref, *_context);
+			if(parsed) {
+				module = std::move(*parsed);
+			} else {
+				llvm::consumeError(parsed.takeError());
+			}
+		}
+		if(module == nullptr) {
+			function.cached = false;
+			function.ghidra->startProcessing();
+			assert(!function.ghidra->hasBadData() && "Function flowed into bad data!!!");
+			continue;
+		}
+		link_module(std::move(module));
+	}
+	_cached_functions.clear();
+	
+	// Cached functions are simplified along with the functions the parent
+	// translates, so that they end up the same as if they'd been translated.
+	restore_functions(function_order);
+}
+
+std::vector<std::string> QuadraTranslator::function_names()
+{
+	std::vector<std::string> names;
+	for(llvm::Function& function : *_module) {
+		names.push_back(function.getName().str());
+	}
+	return names;
+}
+
+void QuadraTranslator::link_module(std::unique_ptr<llvm::Module> module)
+{
+	if(llvm::Linker::linkModules(*_module, std::move(module))) {
+		fprintf(stderr, "error: Failed to link translated functions into the main module.\n");
+		exit(1);
+	}
+}
+
+void QuadraTranslator::restore_functions(const std::vector<std::string>& order)
+{
+	// Linking a definition over a declaration replaces the declaration with
+	// a new function at the end of the module.
+	for(auto* functions : {&discovered_functions, &translated_functions}) {
+		for(auto& [address, function] : *functions) {
+			function.llvm = _module->getFunction(_function_names.at(address));
+			if(function.body != nullptr) {
+				function.body = _module->getFunction(_body_names.at(address));
+			}
+		}
+	}
+	
+	std::vector<llvm::Function*> functions;
+	for(const std::string& name : order) {
+		functions.push_back(_module->getFunction(name));
+	}
+	std::set<llvm::Function*> ordered(functions.begin(), functions.end());
+	std::vector<llvm::Function*> new_functions;
+	for(llvm::Function& function : *_module) {
+		if(ordered.count(&function) == 0) {
+			new_functions.push_back(&function);
+		}
+	}
+	std::sort(new_functions.begin(), new_functions.end(), [](llvm::Function* l, llvm::Function* r) {
+		return l->getName() < r->getName();
+	});
+	functions.insert(functions.end(), new_functions.begin(), new_functions.end());
+	for(llvm::Function* function : functions) {
+		function->removeFromParent();
+		_module->getFunctionList().push_back(function);
 	}
 }
 
 void QuadraTranslator::begin_function(QuadraFunction function)
 {
+	if(_parent != nullptr) {
+		const QuadraFunction* imported = import_function(function.ghidra->getAddress());
+		function.llvm = imported->llvm;
+		function.body = imported->body;
+	} else if(_options.ssa) {
+		// The bodies' signatures have to be built from the final summaries,
+		// which calls, returns and arguments are lowered against too.
+		update_register_summaries();
+		declare_bodies();
+		const QuadraFunction& discovered = discovered_functions.at(function.ghidra->getAddress());
+		function.registers = discovered.registers;
+		function.body = discovered.body;
+	}
 	_function = std::move(function);
+	if(_options.fast_math) {
+		// Flush denormals to zero, as the R5900 does.
+		llvm_function()->addFnAttr("denormal-fp-math", "preserve-sign,preserve-sign");
+	}
+	if(_options.optimize_pcode) {
+		_pcode_optimizer->begin_function(*_function.ghidra);
+	}
 	
 	auto blocks = _function.ghidra->getBasicBlocks().getList();
 	assert(blocks.size() >= 1);
-	_builder.SetInsertPoint(get_block(blocks[0])->llvm);
+	_blocks.clear();
+	_blocks.resize(blocks.size());
+	if(_options.instrument) {
+		create_profile_counters();
+	}
+	
+	// Setup code goes in its own block, since the first Ghidra block may be
+	// the target of a branch.
+	llvm::BasicBlock* entry = llvm::BasicBlock::Create(*_context, "entry", llvm_function());
+	_function.entry.llvm = entry;
+	_function.entry.exit = entry;
+	_function.entry.filled = true;
+	_function.entry.sealed = true;
+	_builder.SetInsertPoint(entry);
 	
 	if(!STORE_REGISTERS_IN_GLOBAL) {
 		auto registers_type = llvm::ArrayType::get(int_type(1), _register_space_size);
@@ -53,35 +427,82 @@ void QuadraTranslator::begin_function(QuadraFunction function)
 		_function.register_alloca = _builder.CreatePointerCast(registers_alloca, register_ptr_type, "");
 	}
 	
-	// HACK: Stack frame size fixed at 0x2000.
-	auto stack_type = llvm::ArrayType::get(int_type(1), 0x2000);
-	llvm::AllocaInst* stack_alloca = _builder.CreateAlloca(stack_type, nullptr, "stackframe");
-	_function.stack_space = stack_alloca->getType()->getAddressSpace();
-	auto stack_ptr_type = llvm::PointerType::get(int_type(1), _function.stack_space);
-	_function.stack_alloca = _builder.CreatePointerCast(stack_alloca, stack_ptr_type, "");
+	if(_flat_memory) {
+		// The base never changes once the runtime has set it up.
+		llvm::LoadInst* base = _builder.CreateLoad(_memory_base_global->getValueType(), _memory_base_global, "memory_base");
+		base->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(*_context, {}));
+		_function.memory_base = base;
+	}
+	
+	_builder.CreateBr(get_block(blocks[0])->llvm);
 }
 
 void QuadraTranslator::end_function()
 {
+	if(_options.ssa) {
+		for(const FlowBlock* block : _function.ghidra->getBasicBlocks().getList()) {
+			try_seal_block(dynamic_cast<const BlockBasic*>(block));
+			assert(ssa_block(dynamic_cast<const BlockBasic*>(block)).sealed);
+		}
+		create_entry_thunk();
+	}
+	if(_profile != nullptr) {
+		set_entry_counts();
+	}
+	
+	if(_cache != nullptr && !_function.cache_key.empty()) {
+		store_in_cache();
+	}
+	if(!_options.stream_directory.empty()) {
+		stream_function();
+	}
+	
+	// Callers only need the signature and register summary from here on.
+	_blocks.clear();
+	_function.locals = {};
+	_function.register_pointers = {};
+	_function.entry = QuadraBlock();
+	_function.ssa_variables = {};
+	_function.ssa_variable_sizes = {};
+	
 	Address address = _function.ghidra->getAddress();
 	translated_functions.emplace(address, std::move(_function));
+	_function = QuadraFunction();
 }
 
 void QuadraTranslator::begin_block(const BlockBasic* gblock, llvm::Twine& name)
 {
 	_gblock = gblock;
+	if(_options.optimize_pcode) {
+		_optimized = _pcode_optimizer->optimize(gblock);
+	} else {
+		_optimized = _pcode_optimizer->remove_dead_registers(gblock);
+	}
 	llvm::BasicBlock* lblock = get_block(gblock)->llvm;
 	lblock->setName(name);
 	_builder.SetInsertPoint(lblock);
+	if(_options.ssa) {
+		try_seal_block(gblock);
+	}
+	if(_options.instrument) {
+		increment_counter(gblock->getIndex());
+	}
 }
 
 void QuadraTranslator::end_block()
 {
-	QuadraBlock& block = _blocks[_gblock];
+	QuadraBlock& block = *get_block(_gblock);
 	if(!block.emitted_branch) {
 		assert(_gblock->sizeOut() == 1);
 		_builder.CreateBr(get_block(_gblock->getOut(0))->llvm);
 	}
+	block.exit = _builder.GetInsertBlock();
+	block.filled = true;
+	if(_options.ssa) {
+		for(int4 i = 0; i < _gblock->sizeOut(); i++) {
+			try_seal_block(dynamic_cast<const BlockBasic*>(_gblock->getOut(i)));
+		}
+	}
 	_gblock = nullptr;
 }
 
@@ -89,13 +510,17 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 {
 	assert(_gblock != nullptr && "QuadraTranslator::translate_pcodeop called outside a block!");
 	
-	QuadraBlock& block = _blocks[_gblock];
+	if(_optimized.dead.count(&op) == 1) {
+		return;
+	}
+	
+	QuadraBlock& block = *get_block(_gblock);
 	int4 isize = op.numInput();
 	
-	llvm::Value* inputs[3];
-	assert(isize >= 0 && isize <= 3);
+	// User-ops can take any number of inputs.
+	llvm::SmallVector<llvm::Value*, 3> inputs;
 	for(int4 i = 0; i < isize; i++) {
-		inputs[i] = get_input(op.getIn(i));
+		inputs.push_back(get_optimized_input(op, i));
 	}
 	
 	llvm::Value* output = nullptr;
@@ -109,19 +534,19 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 			break;
 		case CPUI_LOAD: { // 2
 			assert(isize == 2);
-			if(((ElfLoader*) _arch->loader)->machine() == ElfMachine::AMD64) {
-				output = inputs[0];
+			type = int_type(op.getOut()->getSize());
+			if(llvm::Value* ptr = segment_pointer(inputs[1], op.getOut()->getSize())) {
+				output = _builder.CreateLoad(type, ptr);
 				break;
 			}
-			type = llvm::PointerType::get(int_type(op.getOut()->getSize()), _function.stack_space);
-			tmp1 = decompress_pointer(inputs[1], _function.stack_alloca, type);
-			output = _builder.CreateLoad(tmp1, "");
+			tmp1 = guest_pointer(inputs[1], type->getPointerTo(), _function.memory_base);
+			output = _builder.CreateLoad(type, tmp1, "");
 			break;
 		}
 		case CPUI_STORE: // 3
 			assert(isize == 3);
-			type = llvm::PointerType::get(int_type(op.getIn(2)->getSize()), _function.stack_space);
-			tmp1 = decompress_pointer(inputs[1], _function.stack_alloca, type);
+			type = int_type(op.getIn(2)->getSize())->getPointerTo();
+			tmp1 = guest_pointer(inputs[1], type, _function.memory_base);
 			output = _builder.CreateStore(inputs[2], tmp1, false);
 			break;
 		case CPUI_BRANCH: // 4
@@ -133,37 +558,226 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 		case CPUI_CBRANCH: // 5
 			assert(isize == 2);
 			assert(_gblock->sizeOut() == 2);
-			tmp1 = _builder.CreateICmpNE(inputs[1], zero(op.getIn(1)->getSize()));
+			if(_optimized.fused_compare != nullptr) {
+				tmp1 = _condition;
+			} else {
+				tmp1 = _builder.CreateICmpNE(inputs[1], zero(op.getIn(1)->getSize()));
+			}
 			output = _builder.CreateCondBr(
 				tmp1,
 				get_block(_gblock->getTrueOut())->llvm,
-				get_block(_gblock->getFalseOut())->llvm);
+				get_block(_gblock->getFalseOut())->llvm,
+				branch_weights(_gblock, {_gblock->getTrueOut(), _gblock->getFalseOut()}));
+			block.emitted_branch = true;
+			break;
+		case CPUI_BRANCHIND: { // 6
+			assert(isize == 1);
+			// Ghidra has already recovered the jump table, if there is one, and
+			// added an edge to each target. Branch to them with a switch on the
+			// target address, which LLVM can turn into a jump table of its own.
+			llvm::Value* target = inputs[0];
+			if(_flat_memory) {
+				target = _builder.CreateZExtOrTrunc(target, int_type(4));
+			}
+			// Read the registers for the fallback below while still in this
+			// block, since it's the only one their SSA values are known in.
+			std::vector<bool> observed;
+			std::vector<llvm::Value*> observed_values;
+			if(_options.ssa) {
+				update_register_summaries();
+				observed = touched_registers(_indirect_registers);
+				for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+					if(observed[slot]) {
+						observed_values.push_back(read_variable(slot, _gblock));
+					}
+				}
+			}
+			llvm::BasicBlock* unresolved = llvm::BasicBlock::Create(*_context, "unresolved", llvm_function());
+			llvm::SwitchInst* cases = _builder.CreateSwitch(target, unresolved);
+			const JumpTable* table = _function.ghidra->findJumpTable(&op);
+			std::set<uintb> targets;
+			for(int4 i = 0; table != nullptr && table->isRecovered() && i < table->numEntries(); i++) {
+				targets.insert(table->getAddressByIndex(i).getOffset());
+			}
+			// Ghidra may list the same out edge more than once, and a switch
+			// can't have duplicate cases.
+			std::vector<const FlowBlock*> case_blocks;
+			std::set<uintb> added;
+			for(int4 i = 0; i < _gblock->sizeOut(); i++) {
+				const BlockBasic* out = dynamic_cast<const BlockBasic*>(_gblock->getOut(i));
+				uintb offset = out->getEntryAddr().getOffset();
+				if(targets.count(offset) == 1 && added.insert(offset).second) {
+					cases->addCase(llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(target->getType()), offset), get_block(out)->llvm);
+					case_blocks.push_back(out);
+				}
+			}
+			if(_profile != nullptr) {
+				// The unresolved case is weighted as never taken.
+				std::vector<const FlowBlock*> successors = {nullptr};
+				successors.insert(successors.end(), case_blocks.begin(), case_blocks.end());
+				cases->setMetadata(llvm::LLVMContext::MD_prof, branch_weights(_gblock, successors));
+			}
+			
+			// Anything else is a branch Ghidra couldn't follow, e.g. a tail call
+			// through a register, so look the target up in the function table
+			// and tail call it, like CPUI_CALLIND followed by CPUI_RETURN.
+			llvm::IRBuilder<> fallback(unresolved);
+			llvm::Value* found = fallback.CreateCall(function_finder(), {fallback.CreateZExt(target, int_type(8))});
+			size_t index = 0;
+			for(size_t slot = 0; slot < observed.size(); slot++) {
+				if(observed[slot]) {
+					const RegisterSlot& range = _register_slots[slot];
+					VarnodeData reg{_ghidra_register_space, range.offset, range.size};
+					fallback.CreateStore(observed_values[index++], get_register(reg));
+				}
+			}
+			llvm::FunctionType* callee_type = llvm::FunctionType::get(int_type(8), false);
+			llvm::CallInst* tail_call = fallback.CreateCall(callee_type, fallback.CreatePointerCast(found, callee_type->getPointerTo()));
+			if(_options.ssa) {
+				// The callee may have written any register, so return them all
+				// from the register file.
+				llvm::Value* results = llvm::UndefValue::get(_function.body->getReturnType());
+				unsigned int result = 0;
+				for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+					if(_function.registers.written[slot]) {
+						const RegisterSlot& range = _register_slots[slot];
+						VarnodeData reg{_ghidra_register_space, range.offset, range.size};
+						results = fallback.CreateInsertValue(results, fallback.CreateLoad(ssa_type(slot), get_register(reg)), result++);
+					}
+				}
+				fallback.CreateRet(results);
+			} else {
+				tail_call->setTailCall();
+				fallback.CreateRet(tail_call);
+			}
+			
+			// The table is outside the function's code, so it isn't covered by
+			// the cache key.
+			_function.cache_key.clear();
+			output = cases;
 			block.emitted_branch = true;
 			break;
+		}
 		case CPUI_CALL: { // 7
 			assert(isize == 1);
 			FuncCallSpecs* call = _function.ghidra->getCallSpecs(&op);
 			Address callee_addr = call->getEntryAddress();
 			QuadraFunction* callee = get_function(callee_addr, nullptr);
+			if(_options.instrument) {
+				increment_counter(_call_counters.at(&op));
+			}
+			if(_options.ssa) {
+				// Pass the registers the callee touches directly, and take back
+				// the ones it may write.
+				update_register_summaries();
+				std::vector<llvm::Value*> arguments;
+				std::vector<bool> touched = touched_registers(callee->registers);
+				for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+					if(touched[slot]) {
+						arguments.push_back(read_variable(slot, _gblock));
+					}
+				}
+				assert(callee->body != nullptr);
+				llvm::CallInst* results = _builder.CreateCall(callee->body, arguments);
+				results->setCallingConv(llvm::CallingConv::Fast);
+				unsigned int index = 0;
+				for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+					if(callee->registers.written[slot]) {
+						write_variable(slot, _gblock, _builder.CreateExtractValue(results, index++));
+					}
+				}
+				output = results;
+				break;
+			}
 			llvm::Value* return_value = _builder.CreateCall(callee->llvm, {}, "", nullptr);
 			VarnodeData return_reg = _arch->translate->getRegister(_arch->return_register());
-			Address return_addr = Address(_arch->getSpaceByName("register"), return_reg.offset);
-			llvm::Value* v0 = get_local(_function.ghidra->newVarnode(
-				return_reg.size, return_addr));
-			output = _builder.CreateStore(return_value, v0);
+			write_register(return_reg, _builder.CreateZExtOrTrunc(return_value, int_type(return_reg.size)));
+			output = return_value;
+			break;
+		}
+		case CPUI_CALLIND: { // 8
+			assert(isize >= 1);
+			// Each call site remembers the last target it looked up, so calling
+			// the same function again costs a compare and a branch. Otherwise
+			// the target is looked up in the function table.
+			llvm::Type* address_type = int_type(8);
+			llvm::PointerType* host_type = llvm::Type::getInt8PtrTy(*_context);
+			llvm::StructType* cache_type = llvm::StructType::get(*_context, {address_type, host_type});
+			std::stringstream cache_name;
+			cache_name << "callind_cache_" << std::hex << op.getAddr().getOffset();
+			llvm::GlobalVariable* cache = new llvm::GlobalVariable(
+				*_module,
+				cache_type,
+				false,
+				llvm::GlobalValue::InternalLinkage,
+				llvm::ConstantStruct::get(cache_type, {
+					llvm::ConstantInt::get(address_type, -1),
+					llvm::ConstantPointerNull::get(host_type)
+				}),
+				cache_name.str());
+			
+			llvm::Value* target = inputs[0];
+			if(_flat_memory) {
+				target = _builder.CreateTrunc(target, int_type(4));
+			}
+			target = _builder.CreateZExtOrTrunc(target, address_type);
+			llvm::Value* cached_target_ptr = _builder.CreateStructGEP(cache_type, cache, 0);
+			llvm::Value* cached_host_ptr = _builder.CreateStructGEP(cache_type, cache, 1);
+			llvm::Value* hit = _builder.CreateICmpEQ(_builder.CreateLoad(address_type, cached_target_ptr), target);
+			llvm::BasicBlock* before = _builder.GetInsertBlock();
+			llvm::BasicBlock* miss = llvm::BasicBlock::Create(*_context, "callind_miss", llvm_function());
+			llvm::BasicBlock* call = llvm::BasicBlock::Create(*_context, "callind", llvm_function());
+			llvm::Value* cached_host = _builder.CreateLoad(host_type, cached_host_ptr);
+			_builder.CreateCondBr(hit, call, miss, llvm::MDBuilder(*_context).createBranchWeights(2000, 1));
+			
+			_builder.SetInsertPoint(miss);
+			llvm::Value* found_host = _builder.CreateCall(function_finder(), {target});
+			_builder.CreateStore(target, cached_target_ptr);
+			_builder.CreateStore(found_host, cached_host_ptr);
+			_builder.CreateBr(call);
+			
+			_builder.SetInsertPoint(call);
+			llvm::PHINode* host = _builder.CreatePHI(host_type, 2);
+			host->addIncoming(cached_host, before);
+			host->addIncoming(found_host, miss);
+			if(_options.ssa) {
+				update_register_summaries();
+				write_back_registers(touched_registers(_indirect_registers));
+			}
+			llvm::FunctionType* callee_type = llvm::FunctionType::get(int_type(8), false);
+			llvm::Value* callee = _builder.CreatePointerCast(host, callee_type->getPointerTo());
+			llvm::Value* return_value = _builder.CreateCall(callee_type, callee);
+			if(_options.ssa) {
+				clobber_registers(_indirect_registers.written);
+			}
+			VarnodeData return_reg = _arch->translate->getRegister(_arch->return_register());
+			write_register(return_reg, _builder.CreateZExtOrTrunc(return_value, int_type(return_reg.size)));
+			output = return_value;
 			break;
 		}
 		case CPUI_CALLOTHER: // 9
-			output = _builder.CreateCall(_syscall_dispatcher);
+			translate_userop(op, inputs);
 			return;
 		case CPUI_RETURN: { // 10
 			assert(isize == 1);
+			if(_options.ssa) {
+				// Return everything the function may have written, see
+				// create_entry_thunk.
+				llvm::Value* results = llvm::UndefValue::get(_function.body->getReturnType());
+				unsigned int index = 0;
+				for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+					if(_function.registers.written[slot]) {
+						results = _builder.CreateInsertValue(results, read_variable(slot, _gblock), index++);
+					}
+				}
+				output = _builder.CreateRet(results);
+				block.emitted_branch = true;
+				break;
+			}
 			// HACK!
 			VarnodeData return_reg = _arch->translate->getRegister(_arch->return_register());
-			Address return_addr = Address(_arch->getSpaceByName("register"), return_reg.offset);
-			tmp1 = get_input(_function.ghidra->newVarnode(
-				return_reg.size, return_addr));
-			output = _builder.CreateRet(_builder.CreateZExt(tmp1, int_type(8)));
+			tmp1 = read_register(return_reg);
+			output = _builder.CreateRet(_builder.CreateZExtOrTrunc(tmp1, int_type(8)));
 			block.emitted_branch = true;
 			break;
 		}
@@ -188,7 +802,14 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 			output = _builder.CreateZExt(tmp1, int_type(1), ""); // i1 -> i8
 			break;
 		case CPUI_INT_LESS: // 15
+			assert(isize == 2);
+			tmp1 = _builder.CreateICmpULT(inputs[0], inputs[1], "");
+			output = _builder.CreateZExt(tmp1, int_type(1), ""); // i1 -> i8
+			break;
 		case CPUI_INT_LESSEQUAL: // 16
+			assert(isize == 2);
+			tmp1 = _builder.CreateICmpULE(inputs[0], inputs[1], "");
+			output = _builder.CreateZExt(tmp1, int_type(1), ""); // i1 -> i8
 			break;
 		case CPUI_INT_ZEXT: // 17
 			assert(isize == 1);
@@ -210,15 +831,15 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 			break;
 		case CPUI_INT_CARRY: // 21
 			assert(isize == 2);
-			// Obviously wrong!
-			output = _builder.CreateTrunc(inputs[0], int_type(op.getOut()->getSize()));
+			output = overflow_flag(llvm::Intrinsic::uadd_with_overflow, inputs[0], inputs[1], op.getOut()->getSize());
 			break;
 		case CPUI_INT_SCARRY: // 22
 			assert(isize == 2);
-			// Obviously wrong!
-			output = _builder.CreateTrunc(inputs[0], int_type(op.getOut()->getSize()));
+			output = overflow_flag(llvm::Intrinsic::sadd_with_overflow, inputs[0], inputs[1], op.getOut()->getSize());
 			break;
 		case CPUI_INT_SBORROW: // 23
+			assert(isize == 2);
+			output = overflow_flag(llvm::Intrinsic::ssub_with_overflow, inputs[0], inputs[1], op.getOut()->getSize());
 			break;
 		case CPUI_INT_2COMP: // 24
 			assert(isize == 1);
@@ -286,45 +907,205 @@ void QuadraTranslator::translate_pcodeop(const PcodeOp& op)
 			output = _builder.CreateZExt(tmp1, int_type(1), "");
 			break;
 		case CPUI_BOOL_XOR: // 38
+			assert(isize == 2);
+			output = _builder.CreateXor(inputs[0], inputs[1]);
+			break;
 		case CPUI_BOOL_AND: // 39
+			assert(isize == 2);
+			output = _builder.CreateAnd(inputs[0], inputs[1]);
+			break;
 		case CPUI_BOOL_OR: // 40
+			assert(isize == 2);
+			output = _builder.CreateOr(inputs[0], inputs[1]);
+			break;
+		case CPUI_FLOAT_EQUAL: // 41
+			assert(isize == 2);
+			tmp1 = _builder.CreateFCmpOEQ(to_float(inputs[0]), to_float(inputs[1]));
+			output = _builder.CreateZExt(tmp1, int_type(1));
+			break;
+		case CPUI_FLOAT_NOTEQUAL: // 42
+			assert(isize == 2);
+			tmp1 = _builder.CreateFCmpUNE(to_float(inputs[0]), to_float(inputs[1]));
+			output = _builder.CreateZExt(tmp1, int_type(1));
+			break;
+		case CPUI_FLOAT_LESS: // 43
+			assert(isize == 2);
+			tmp1 = _builder.CreateFCmpOLT(to_float(inputs[0]), to_float(inputs[1]));
+			output = _builder.CreateZExt(tmp1, int_type(1));
+			break;
+		case CPUI_FLOAT_LESSEQUAL: // 44
+			assert(isize == 2);
+			tmp1 = _builder.CreateFCmpOLE(to_float(inputs[0]), to_float(inputs[1]));
+			output = _builder.CreateZExt(tmp1, int_type(1));
+			break;
+		case CPUI_FLOAT_NAN: // 46
+			assert(isize == 1);
+			tmp1 = _builder.CreateFCmpUNO(to_float(inputs[0]), to_float(inputs[0]));
+			output = _builder.CreateZExt(tmp1, int_type(1));
+			break;
+		case CPUI_FLOAT_ADD: // 47
+			assert(isize == 2);
+			output = from_float(_builder.CreateFAdd(to_float(inputs[0]), to_float(inputs[1])));
+			break;
+		case CPUI_FLOAT_DIV: // 48
+			assert(isize == 2);
+			output = from_float(_builder.CreateFDiv(to_float(inputs[0]), to_float(inputs[1])));
+			break;
+		case CPUI_FLOAT_MULT: // 49
+			assert(isize == 2);
+			output = from_float(_builder.CreateFMul(to_float(inputs[0]), to_float(inputs[1])));
+			break;
+		case CPUI_FLOAT_SUB: // 50
+			assert(isize == 2);
+			output = from_float(_builder.CreateFSub(to_float(inputs[0]), to_float(inputs[1])));
+			break;
+		case CPUI_FLOAT_NEG: // 51
+			assert(isize == 1);
+			output = from_float(_builder.CreateFNeg(to_float(inputs[0])));
+			break;
+		case CPUI_FLOAT_ABS: // 52
+			assert(isize == 1);
+			output = from_float(_builder.CreateUnaryIntrinsic(llvm::Intrinsic::fabs, to_float(inputs[0])));
+			break;
+		case CPUI_FLOAT_SQRT: // 53
+			assert(isize == 1);
+			output = from_float(_builder.CreateUnaryIntrinsic(llvm::Intrinsic::sqrt, to_float(inputs[0])));
+			break;
+		case CPUI_FLOAT_INT2FLOAT: // 54
+			assert(isize == 1);
+			output = from_float(_builder.CreateSIToFP(inputs[0], float_type(op.getOut()->getSize())));
+			break;
+		case CPUI_FLOAT_FLOAT2FLOAT: // 55
+			assert(isize == 1);
+			output = from_float(_builder.CreateFPCast(to_float(inputs[0]), float_type(op.getOut()->getSize())));
+			break;
+		case CPUI_FLOAT_TRUNC: // 56
+			assert(isize == 1);
+			// Out of range values saturate instead of being poison.
+			output = _builder.CreateIntrinsic(
+				llvm::Intrinsic::fptosi_sat,
+				{int_type(op.getOut()->getSize()), float_type(op.getIn(0)->getSize())},
+				{to_float(inputs[0])});
+			break;
+		case CPUI_FLOAT_CEIL: // 57
+			assert(isize == 1);
+			output = from_float(_builder.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, to_float(inputs[0])));
+			break;
+		case CPUI_FLOAT_FLOOR: // 58
+			assert(isize == 1);
+			output = from_float(_builder.CreateUnaryIntrinsic(llvm::Intrinsic::floor, to_float(inputs[0])));
+			break;
+		case CPUI_FLOAT_ROUND: // 59
+			assert(isize == 1);
+			// Rounds in the current rounding mode, which like the guest's
+			// default is to nearest with ties to even. Changes the guest makes
+			// to its rounding mode aren't tracked.
+			output = from_float(_builder.CreateUnaryIntrinsic(llvm::Intrinsic::rint, to_float(inputs[0])));
 			break;
 		case CPUI_SUBPIECE: { // 63
 			assert(isize == 2);
 			assert(op.getIn(1)->getAddr().isConstant());
-			llvm::APInt shift_val(op.getIn(0)->getSize() * 8, op.getIn(0)->getOffset() * 8, false);
-			llvm::Value* shift = llvm::ConstantInt::get(_context, shift_val);
-			llvm::Value* shifted = _builder.CreateAShr(inputs[0], shift, "", false);
+			llvm::APInt shift_val(op.getIn(0)->getSize() * 8, op.getIn(1)->getOffset() * 8, false);
+			llvm::Value* shift = llvm::ConstantInt::get(*_context, shift_val);
+			llvm::Value* shifted = _builder.CreateLShr(inputs[0], shift, "", false);
 			output = _builder.CreateTrunc(shifted, int_type(op.getOut()->getSize()), "");
 			break;
 		}
 		case CPUI_POPCOUNT: // 72
 			assert(isize == 1);
-			// Obviously wrong!
-			output = _builder.CreateTrunc(inputs[0], int_type(op.getOut()->getSize()));
+			tmp1 = _builder.CreateUnaryIntrinsic(llvm::Intrinsic::ctpop, inputs[0]);
+			output = _builder.CreateZExtOrTrunc(tmp1, int_type(op.getOut()->getSize()));
 			break;
 	}
 	
 	assert(output != nullptr && "Unimplemented or bad pcodeop!!!");
+	if(&op == _optimized.fused_compare) {
+		// Compares set tmp1 to the i1 result. Nothing else reads a fused
+		// temporary, so only registers need writing.
+		_condition = tmp1;
+		if(op.getOut()->getSpace() != _ghidra_register_space) {
+			return;
+		}
+	}
 	if(op.getOut() != nullptr) {
 		assert(op.getOut()->getSize() * 8 == output->getType()->getScalarSizeInBits());
-		_builder.CreateStore(output, get_local(op.getOut()), false);
+		set_output(op.getOut(), output);
+	}
+}
+
+void QuadraTranslator::create_main(llvm::Function* entry)
+{
+	// The host entry point sets up the guest's memory and stack pointer, then
+	// calls the guest's entry point. Every guest function runs on that one
+	// stack, so frames are exactly as big as the guest code makes them.
+	create_function_table();
+	
+	assert(_main != nullptr && _main->empty() && _main->getName() == "main");
+	llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*_context, "entry", _main));
+	
+	llvm::Value* stack_pointer;
+	llvm::Type* table_type = llvm::Type::getInt8PtrTy(*_context);
+	llvm::Value* segments = builder.CreatePointerCast(_segment_table, table_type);
+	llvm::Value* segment_count = llvm::ConstantInt::get(int_type(8), _segment_table->getValueType()->getArrayNumElements());
+	if(_flat_memory) {
+		llvm::FunctionType* init_type = llvm::FunctionType::get(int_type(4), {table_type, int_type(8)}, false);
+		llvm::FunctionCallee init = _module->getOrInsertFunction("__quadra_init_memory", init_type);
+		stack_pointer = builder.CreateCall(init, {segments, segment_count});
+	} else {
+		// Guest addresses are host addresses, so the segments and the stack
+		// are host mappings.
+		llvm::FunctionType* map_type = llvm::FunctionType::get(llvm::Type::getVoidTy(*_context), {table_type, int_type(8)}, false);
+		llvm::FunctionCallee map = _module->getOrInsertFunction("__quadra_map_segments", map_type);
+		builder.CreateCall(map, {segments, segment_count});
+		llvm::FunctionCallee init = _module->getOrInsertFunction("__quadra_init_stack", int_type(8));
+		stack_pointer = builder.CreateCall(init);
 	}
+	VarnodeData sp = _arch->translate->getRegister(_arch->stack_pointer_register());
+	llvm::Value* sp_ptr = create_pointer_to_register(sp, builder);
+	builder.CreateStore(builder.CreateSExtOrTrunc(stack_pointer, int_type(sp.size)), sp_ptr);
+	
+	llvm::Value* exit_code = builder.CreateCall(entry);
+	builder.CreateRet(builder.CreateTrunc(exit_code, int_type(4)));
+}
+
+const PcodeStats& QuadraTranslator::pcode_stats()
+{
+	return _pcode_optimizer->stats;
+}
+
+llvm::Module& QuadraTranslator::module()
+{
+	return *_module;
 }
 
-void QuadraTranslator::print()
+std::unique_ptr<llvm::Module> QuadraTranslator::take_module()
 {
-	_module.print(llvm::outs(), nullptr);
+	// The SSA state holds handles to values in the module.
+	_blocks.clear();
+	_function = QuadraFunction();
+	return std::move(_module);
 }
 
-QuadraFunction* QuadraTranslator::get_function(Address address, const char* name)
+std::unique_ptr<llvm::LLVMContext> QuadraTranslator::take_context()
+{
+	assert(_module == nullptr && "The module has to be taken before its context!");
+	return std::move(_context);
+}
+
+QuadraFunction* QuadraTranslator::get_function(Address address, const char* name, uint64_t size)
 {
 	if(_function.ghidra != nullptr && _function.ghidra->getAddress() == address) {
 		return &_function;
 	}
+	if(_parent != nullptr) {
+		return import_function(address);
+	}
 	
 	auto discovered_iter = discovered_functions.find(address);
 	if(discovered_iter != discovered_functions.end()) {
+		if(discovered_iter->second.size == 0) {
+			discovered_iter->second.size = size;
+		}
 		return &discovered_iter->second;
 	}
 	
@@ -333,40 +1114,114 @@ QuadraFunction* QuadraTranslator::get_function(Address address, const char* name
 		return &translated_iter->second;
 	}
 	
+	// Functions found by following calls still get their symbol's name.
+	const ElfFunctionSymbol* elf_symbol = ((ElfLoader*) _arch->loader)->function_symbol(address.getOffset());
+	if(elf_symbol != nullptr) {
+		if(name == nullptr && !elf_symbol->name.empty()) {
+			name = elf_symbol->name.c_str();
+		}
+		if(size == 0) {
+			size = elf_symbol->size;
+		}
+	}
+	
+	// Local symbols such as init or frame_dummy are often defined more than
+	// once, and guest names can clash with the host's globals, so names that
+	// are already taken get the address appended.
 	std::stringstream name_ss;
 	if(name != nullptr) {
 		name_ss << name;
+		if(_module->getNamedValue(name) != nullptr) {
+			name_ss << '_' << std::hex << address.getOffset();
+		}
 	} else {
 		name_ss << "func_" << std::hex << address.getOffset();
 	}
 	
 	QuadraFunction& function = discovered_functions[address];
+	function.size = size;
 	// The Funcdata object is owned by the FunctionSymbol object, which is in
 	// turn owned by a Scope object, which is owned by a Database object, which
 	// is owned by the Architecture object.
 	FunctionSymbol* symbol = _arch->symboltab->getGlobalScope()->addFunction(address, name_ss.str());
 	function.ghidra = symbol->getFunction();
 	
-	// Generate pcode ops, basic blocks and call specs.
-	function.ghidra->startProcessing();
-	assert(!function.ghidra->hasBadData() && "Function flowed into bad data!!!");
+	// Only functions with a known size can be cached, since the key has to
+	// cover all of their code. A hit skips Ghidra entirely.
+	if(_cache != nullptr && size != 0) {
+		function.cache_key = cache_key(address, size);
+		CachedFunction cached;
+		if(!function.cache_key.empty() && _cache->load(function.cache_key, cached)) {
+			for(uint64_t callee : cached.callees) {
+				function.callees.push_back(Address(address.getSpace(), callee));
+			}
+			function.local_registers.read = cached.registers_read;
+			function.local_registers.written = cached.registers_written;
+			function.registers = function.local_registers;
+			function.calls_indirectly = cached.calls_indirectly;
+			function.cached = true;
+			_cached_functions[address] = std::move(cached);
+		}
+	}
+	
+	if(!function.cached) {
+		// Generate pcode ops, basic blocks and call specs.
+		function.ghidra->startProcessing();
+		assert(!function.ghidra->hasBadData() && "Function flowed into bad data!!!");
+		if(_options.ssa) {
+			scan_registers(function);
+		}
+		for(int4 i = 0; i < function.ghidra->numCalls(); i++) {
+			Address callee = function.ghidra->getCallSpecs(i)->getEntryAddress();
+			if(!callee.isInvalid()) {
+				function.callees.push_back(callee);
+			}
+		}
+	}
+	
+	if(size != 0 && !function.cached) {
+		uint64_t end = address.getOffset() + size;
+		for(const FlowBlock* block : function.ghidra->getBasicBlocks().getList()) {
+			if(block->getStart().getOffset() < address.getOffset() || block->getStop().getOffset() >= end) {
+				fprintf(stderr, "warning: %s flowed outside of its symbol's bounds.\n", name_ss.str().c_str());
+				break;
+			}
+		}
+	}
+	
+	// Functions are made internal by link_workers once they've all been
+	// translated.
+	llvm::FunctionType* func_type = llvm::FunctionType::get(llvm::Type::getInt64Ty(*_context), false);
+	function.llvm = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage, name_ss.str(), *_module);
+	_function_names[address] = function.llvm->getName().str();
 	
-	llvm::FunctionType* func_type = llvm::FunctionType::get(llvm::Type::getInt64Ty(_context), false);
-	function.llvm = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage, name_ss.str(), _module);
+	// Discover callees straight away, so that by the time a function is
+	// translated everything it can call is known.
+	_register_summaries_dirty = true;
+	for(Address callee : function.callees) {
+		get_function(callee);
+	}
 	return &function;
 }
 
+QuadraFunction* QuadraTranslator::import_function(Address address)
+{
+	auto iter = _imported_functions.find(address);
+	if(iter == _imported_functions.end()) {
+		fprintf(stderr, "error: Function at 0x%lx wasn't discovered before translation started.\n", address.getOffset());
+		exit(1);
+	}
+	return &iter->second;
+}
+
 QuadraBlock* QuadraTranslator::get_block(const FlowBlock* gblock)
 {
 	const BlockBasic* basic_gblock = dynamic_cast<const BlockBasic*>(gblock);
 	assert(basic_gblock != nullptr);
-	auto iter = _blocks.find(basic_gblock);
-	if(iter != _blocks.end()) {
-		return &iter->second;
+	QuadraBlock& block = _blocks.at(basic_gblock->getIndex());
+	if(block.llvm == nullptr) {
+		block.llvm = llvm::BasicBlock::Create(*_context, "", llvm_function());
 	}
-	
-	QuadraBlock& block = _blocks[basic_gblock];
-	block.llvm = llvm::BasicBlock::Create(_context, "", _function.llvm, block.llvm);
 	return &block;
 }
 
@@ -377,15 +1232,40 @@ llvm::Value* QuadraTranslator::get_input(const Varnode* var)
 		return llvm::ConstantInt::get(type, llvm::APInt(var->getSize() * 8, var->getOffset(), false));
 	}
 	
-	// Point the MIPS stack pointer at the stack allocation.
-	if(var->getSpace()->getName() == "register" && var->getOffset() == 0x1d0) {
-		return _builder.CreatePtrToInt(_function.stack_alloca, int_type(var->getSize()));
+	if(var->getSpace() == _ghidra_register_space) {
+		return read_register(varnode_to_varnodedata(var));
+	}
+	if(_options.ssa) {
+		return read_variable(ssa_variable(varnode_to_varnodedata(var)), _gblock);
+	}
+	return _builder.CreateLoad(type, get_local(var), "");
+}
+
+llvm::Value* QuadraTranslator::get_optimized_input(const PcodeOp& op, int4 slot)
+{
+	auto iter = _optimized.inputs.find({&op, slot});
+	if(iter == _optimized.inputs.end()) {
+		return get_input(op.getIn(slot));
+	}
+	if(iter->second.var != nullptr) {
+		return get_input(iter->second.var);
+	}
+	int4 size = op.getIn(slot)->getSize();
+	return llvm::ConstantInt::get(int_type(size), llvm::APInt(size * 8, iter->second.constant, false));
+}
+
+void QuadraTranslator::set_output(const Varnode* var, llvm::Value* value)
+{
+	if(var->getSpace() == _ghidra_register_space) {
+		write_register(varnode_to_varnodedata(var), value);
+	} else if(_options.ssa) {
+		write_variable(ssa_variable(varnode_to_varnodedata(var)), _gblock, value);
+	} else {
+		_builder.CreateStore(value, get_local(var), false);
 	}
-	
-	return _builder.CreateLoad(get_local(var), "");
 }
 
-VarnodeData varnode_to_varnodedata(const Varnode* var)
+static VarnodeData varnode_to_varnodedata(const Varnode* var)
 {
 	VarnodeData result;
 	result.space = var->getSpace();
@@ -396,28 +1276,15 @@ VarnodeData varnode_to_varnodedata(const Varnode* var)
 
 llvm::Value* QuadraTranslator::get_local(const Varnode* var)
 {
-	if(var->getSpace()->getName() == "register") {
+	if(var->getSpace() == _ghidra_register_space) {
 		return get_register(varnode_to_varnodedata(var));
 	}
 	
-	auto compare_varnodes = [](const Varnode* l, const Varnode* r) {
-		return l->getSpace()->getIndex() == r->getSpace()->getIndex()
-			&& l->getOffset() == r->getOffset()
-			&& l->getSize() == r->getSize();
-	};
-	
-	llvm::AllocaInst* local = nullptr;
-	for(auto& [current_var, alloca] : _function.locals) {
-		bool cmp = *current_var == *var;
-		if(compare_varnodes(current_var, var)) {
-			local = alloca;
-		}
-	}
-	
+	llvm::AllocaInst*& local = _function.locals[varnode_to_varnodedata(var)];
 	if(local == nullptr) {
 		llvm::IRBuilder<> alloca_builder(
-			&_function.llvm->getEntryBlock(),
-			_function.llvm->getEntryBlock().begin());
+			&llvm_function()->getEntryBlock(),
+			llvm_function()->getEntryBlock().begin());
 		std::stringstream name;
 		name << _arch->translate->getRegisterName(
 			var->getSpace(), var->getOffset(), var->getSize());
@@ -427,7 +1294,6 @@ llvm::Value* QuadraTranslator::get_local(const Varnode* var)
 		name << "l_0x" << std::hex << var->getOffset();
 		name << "_" << var->getSpace()->getName();
 		local = alloca_builder.CreateAlloca(int_type(var->getSize()), 0, name.str());
-		_function.locals[var] = local;
 	}
 	
 	return local;
@@ -442,8 +1308,8 @@ llvm::Value* QuadraTranslator::get_register(VarnodeData reg)
 		// we need to create a pointer to it. For niceness, we put this pointer
 		// in the entry block of the function.
 		llvm::IRBuilder<> entry_builder(
-			&_function.llvm->getEntryBlock(),
-			_function.llvm->getEntryBlock().begin());
+			&llvm_function()->getEntryBlock(),
+			llvm_function()->getEntryBlock().begin());
 		value = create_pointer_to_register(reg, entry_builder);
 		_function.register_pointers[reg] = value;
 	} else {
@@ -452,27 +1318,119 @@ llvm::Value* QuadraTranslator::get_register(VarnodeData reg)
 	return value;
 }
 
-llvm::Value* QuadraTranslator::create_pointer_to_register(VarnodeData reg, llvm::IRBuilder<>& builder)
+static bool merge_registers(std::vector<bool>& dest, const std::vector<bool>& src)
 {
-	auto offset_const = llvm::ConstantInt::get(_context, llvm::APInt(32, reg.offset, false));
-	llvm::Value* ptr8 = builder.CreateGEP(register_storage(), offset_const, "");
-	auto ptr_type = llvm::PointerType::get(int_type(reg.size), _register_space);
-	auto name = _arch->translate->getRegisterName(reg.space, reg.offset, reg.size);
-	return builder.CreatePointerCast(ptr8, ptr_type, name);
-}
+	bool changed = false;
+	for(size_t i = 0; i < dest.size(); i++) {
+		if(src[i] && !dest[i]) {
+			dest[i] = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
 
-llvm::Value* QuadraTranslator::decompress_pointer(llvm::Value* val, llvm::Value* hi, llvm::Type* ptr_type)
+static std::vector<bool> touched_registers(const RegisterSummary& summary)
 {
-	if(((ElfLoader*) _arch->loader)->machine() == ElfMachine::AMD64) {
-		return _builder.CreateIntToPtr(val, ptr_type); // No need to convert between 32 bit/64 bit pointers for amd64.
+	std::vector<bool> touched = summary.read;
+	merge_registers(touched, summary.written);
+	return touched;
+}
+
+static uintb register_shift(const RegisterSlot& slot, VarnodeData reg, bool big_endian)
+{
+	if(big_endian) {
+		return ((slot.offset + slot.size) - (reg.offset + reg.size)) * 8;
+	} else {
+		return (reg.offset - slot.offset) * 8;
 	}
-	auto lo_mask = llvm::ConstantInt::get(_context, llvm::APInt(64, 0x00000000ffffffff, false));
-	auto hi_mask = llvm::ConstantInt::get(_context, llvm::APInt(64, 0xffffffff00000000, false));
-	auto stack_ptr = _builder.CreatePtrToInt(hi, int_type(8));
-	auto stack_ptr_hi = _builder.CreateAnd(stack_ptr, hi_mask);
-	auto lo_ptr = _builder.CreateZExt(_builder.CreateTrunc(val, int_type(4)), int_type(8));
-	auto combined_ptr = _builder.CreateOr(stack_ptr_hi, lo_ptr);
-	return _builder.CreateIntToPtr(combined_ptr, ptr_type);
+}
+
+llvm::Value* QuadraTranslator::read_register(VarnodeData reg)
+{
+	if(!_options.ssa) {
+		return _builder.CreateLoad(int_type(reg.size), get_register(reg));
+	}
+	
+	size_t variable = register_slot(reg);
+	const RegisterSlot& slot = _register_slots[variable];
+	llvm::Value* value = read_variable(variable, _gblock);
+	if(slot.size == reg.size) {
+		return value;
+	}
+	uintb shift = register_shift(slot, reg, _arch->translate->isBigEndian());
+	if(shift != 0) {
+		value = _builder.CreateLShr(value, shift);
+	}
+	return _builder.CreateTrunc(value, int_type(reg.size));
+}
+
+void QuadraTranslator::write_register(VarnodeData reg, llvm::Value* value)
+{
+	if(!_options.ssa) {
+		_builder.CreateStore(value, get_register(reg));
+		return;
+	}
+	
+	size_t variable = register_slot(reg);
+	const RegisterSlot& slot = _register_slots[variable];
+	llvm::Value* slot_value = value;
+	if(slot.size != reg.size) {
+		// Insert the new value into the bits of the slot it covers.
+		uintb shift = register_shift(slot, reg, _arch->translate->isBigEndian());
+		llvm::Type* slot_type = int_type(slot.size);
+		llvm::APInt mask = llvm::APInt::getBitsSet(slot.size * 8, shift, shift + reg.size * 8);
+		llvm::Value* old_value = read_variable(variable, _gblock);
+		llvm::Value* cleared = _builder.CreateAnd(old_value, llvm::ConstantInt::get(slot_type, ~mask));
+		llvm::Value* inserted = _builder.CreateZExt(value, slot_type);
+		if(shift != 0) {
+			inserted = _builder.CreateShl(inserted, shift);
+		}
+		slot_value = _builder.CreateOr(cleared, inserted);
+	}
+	write_variable(variable, _gblock, slot_value);
+}
+
+llvm::Value* QuadraTranslator::create_pointer_to_register(VarnodeData reg, llvm::IRBuilder<>& builder)
+{
+	auto offset_const = llvm::ConstantInt::get(*_context, llvm::APInt(32, reg.offset, false));
+	llvm::Value* ptr8 = builder.CreateGEP(int_type(1), register_storage(), offset_const, "");
+	auto ptr_type = llvm::PointerType::get(int_type(reg.size), _register_space);
+	auto name = _arch->translate->getRegisterName(reg.space, reg.offset, reg.size);
+	return builder.CreatePointerCast(ptr8, ptr_type, name);
+}
+
+llvm::Value* QuadraTranslator::guest_pointer(llvm::Value* address, llvm::Type* ptr_type, llvm::Value* memory_base)
+{
+	if(!_flat_memory) {
+		return _builder.CreateIntToPtr(address, ptr_type); // No need to convert between 32 bit/64 bit pointers for amd64.
+	}
+	llvm::Value* offset = _builder.CreateZExt(_builder.CreateTrunc(address, int_type(4)), int_type(8));
+	llvm::Value* ptr8 = _builder.CreateInBoundsGEP(int_type(1), memory_base, offset);
+	return _builder.CreatePointerCast(ptr8, ptr_type);
+}
+
+llvm::Value* QuadraTranslator::segment_pointer(llvm::Value* address, int4 size)
+{
+	// The builder folds arithmetic on constants as it goes, so in SSA mode
+	// addresses built up from immediates, like lui/addiu pairs, arrive here
+	// as plain integers. Without SSA they go through register memory first
+	// and aren't folded. A variable base plus a constant offset, like a
+	// field of a global struct indexed at runtime, isn't folded either.
+	auto constant = llvm::dyn_cast<llvm::ConstantInt>(address);
+	if(constant == nullptr) {
+		return nullptr;
+	}
+	uint64_t vaddr = constant->getZExtValue();
+	for(QuadraSegment& segment : _segments) {
+		if(segment.writable || vaddr < segment.vaddr || vaddr - segment.vaddr + size > segment.size) {
+			continue;
+		}
+		llvm::Type* segment_type = segment.global->getValueType();
+		llvm::Value* ptr8 = _builder.CreateConstInBoundsGEP2_64(segment_type, segment.global, 0, vaddr - segment.vaddr);
+		return _builder.CreatePointerCast(ptr8, llvm::PointerType::get(int_type(size), 0));
+	}
+	return nullptr;
 }
 
 llvm::Value* QuadraTranslator::register_storage()
@@ -484,6 +1442,661 @@ llvm::Value* QuadraTranslator::register_storage()
 	}
 }
 
+void QuadraTranslator::create_register_slots(const std::map<VarnodeData, std::string>& registers)
+{
+	std::vector<RegisterSlot> ranges;
+	for(auto& [varnode, _] : registers) {
+		if(varnode.space == _ghidra_register_space) {
+			ranges.push_back({varnode.offset, varnode.size});
+		}
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const RegisterSlot& l, const RegisterSlot& r) {
+		return l.offset < r.offset;
+	});
+	
+	// Merge overlapping registers into a single slot.
+	for(RegisterSlot& range : ranges) {
+		if(!_register_slots.empty()) {
+			RegisterSlot& last = _register_slots.back();
+			if(range.offset < last.offset + last.size) {
+				last.size = std::max(last.offset + last.size, range.offset + range.size) - last.offset;
+				continue;
+			}
+		}
+		_register_slots.push_back(range);
+	}
+}
+
+size_t QuadraTranslator::register_slot(VarnodeData reg)
+{
+	auto iter = std::upper_bound(_register_slots.begin(), _register_slots.end(), reg.offset,
+		[](uintb offset, const RegisterSlot& slot) { return offset < slot.offset; });
+	if(iter != _register_slots.begin()) {
+		iter--;
+		if(reg.offset + reg.size <= iter->offset + iter->size) {
+			return iter - _register_slots.begin();
+		}
+	}
+	fprintf(stderr, "error: Register access at 0x%lx of size %d doesn't correspond to any known register. Try --no-ssa.\n", reg.offset, reg.size);
+	exit(1);
+}
+
+size_t QuadraTranslator::ssa_variable(VarnodeData var)
+{
+	auto iter = _function.ssa_variables.find(var);
+	if(iter != _function.ssa_variables.end()) {
+		return iter->second;
+	}
+	size_t variable = _register_slots.size() + _function.ssa_variable_sizes.size();
+	_function.ssa_variables.emplace(var, variable);
+	_function.ssa_variable_sizes.push_back(var.size);
+	return variable;
+}
+
+llvm::Type* QuadraTranslator::ssa_type(size_t variable)
+{
+	if(variable < _register_slots.size()) {
+		return int_type(_register_slots[variable].size);
+	} else {
+		return int_type(_function.ssa_variable_sizes[variable - _register_slots.size()]);
+	}
+}
+
+QuadraBlock& QuadraTranslator::ssa_block(const BlockBasic* gblock)
+{
+	if(gblock == nullptr) {
+		return _function.entry;
+	}
+	return *get_block(gblock);
+}
+
+std::vector<const BlockBasic*> QuadraTranslator::predecessors(const BlockBasic* gblock)
+{
+	std::vector<const BlockBasic*> preds;
+	if(gblock == _function.ghidra->getBasicBlocks().getList()[0]) {
+		preds.push_back(nullptr); // The entry block.
+	}
+	for(int4 i = 0; i < gblock->sizeIn(); i++) {
+		preds.push_back(dynamic_cast<const BlockBasic*>(gblock->getIn(i)));
+	}
+	return preds;
+}
+
+llvm::Value* QuadraTranslator::read_variable(size_t variable, const BlockBasic* gblock)
+{
+	QuadraBlock& block = ssa_block(gblock);
+	auto iter = block.defs.find(variable);
+	if(iter != block.defs.end()) {
+		return iter->second;
+	}
+	return read_variable_recursive(variable, gblock);
+}
+
+llvm::Value* QuadraTranslator::read_variable_recursive(size_t variable, const BlockBasic* gblock)
+{
+	QuadraBlock& block = ssa_block(gblock);
+	llvm::Type* type = ssa_type(variable);
+	bool is_register = variable < _register_slots.size();
+	llvm::Value* value;
+	if(gblock == nullptr && is_register && touched_registers(_function.registers)[variable]) {
+		// Passed in by the caller, see create_entry_thunk.
+		value = _function.body->getArg(body_argument(variable));
+	} else if(gblock == nullptr || (is_register && block.clobbered.count(variable))) {
+		// The register file holds the value after an indirect call or syscall
+		// that may have written to the register.
+		if(is_register) {
+			llvm::IRBuilder<> builder(*_context);
+			position_at_end(builder, gblock);
+			const RegisterSlot& slot = _register_slots[variable];
+			VarnodeData reg{_ghidra_register_space, slot.offset, (uint4) slot.size};
+			value = builder.CreateLoad(type, get_register(reg));
+		} else {
+			value = llvm::UndefValue::get(type);
+		}
+	} else if(!block.sealed) {
+		// Not all the predecessors have been translated yet, so the operands
+		// are filled in later by try_seal_block.
+		llvm::IRBuilder<> builder(block.llvm, block.llvm->begin());
+		llvm::PHINode* phi = builder.CreatePHI(type, 2);
+		block.incomplete_phis[variable] = phi;
+		value = phi;
+	} else {
+		std::vector<const BlockBasic*> preds = predecessors(gblock);
+		if(preds.size() == 0) {
+			value = llvm::UndefValue::get(type); // Unreachable.
+		} else if(preds.size() == 1) {
+			value = read_variable(variable, preds[0]);
+		} else {
+			// Write the phi first to break cycles.
+			llvm::IRBuilder<> builder(block.llvm, block.llvm->begin());
+			llvm::PHINode* phi = builder.CreatePHI(type, preds.size());
+			write_variable(variable, gblock, phi);
+			value = add_phi_operands(variable, phi, gblock);
+		}
+	}
+	write_variable(variable, gblock, value);
+	return value;
+}
+
+void QuadraTranslator::write_variable(size_t variable, const BlockBasic* gblock, llvm::Value* value)
+{
+	ssa_block(gblock).defs[variable] = value;
+}
+
+llvm::Value* QuadraTranslator::add_phi_operands(size_t variable, llvm::PHINode* phi, const BlockBasic* gblock)
+{
+	for(const BlockBasic* pred : predecessors(gblock)) {
+		llvm::Value* value = read_variable(variable, pred);
+		phi->addIncoming(value, ssa_block(pred).exit);
+	}
+	return try_remove_trivial_phi(phi);
+}
+
+llvm::Value* QuadraTranslator::try_remove_trivial_phi(llvm::PHINode* phi)
+{
+	llvm::Value* same = nullptr;
+	for(llvm::Value* operand : phi->incoming_values()) {
+		if(operand == same || operand == phi) {
+			continue;
+		}
+		if(same != nullptr) {
+			return phi; // The phi merges at least two values.
+		}
+		same = operand;
+	}
+	if(same == nullptr) {
+		same = llvm::UndefValue::get(phi->getType());
+	}
+	// The defs are tracking handles, so they get updated too.
+	phi->replaceAllUsesWith(same);
+	phi->eraseFromParent();
+	return same;
+}
+
+void QuadraTranslator::try_seal_block(const BlockBasic* gblock)
+{
+	QuadraBlock& block = ssa_block(gblock);
+	if(block.sealed) {
+		return;
+	}
+	for(const BlockBasic* pred : predecessors(gblock)) {
+		if(!ssa_block(pred).filled) {
+			return;
+		}
+	}
+	block.sealed = true;
+	auto incomplete_phis = std::move(block.incomplete_phis);
+	block.incomplete_phis.clear();
+	for(auto& [variable, phi] : incomplete_phis) {
+		add_phi_operands(variable, phi, gblock);
+	}
+}
+
+void QuadraTranslator::clobber_registers(const std::vector<bool>& written)
+{
+	// Forget the values of the registers a call may have written, so that
+	// they're reloaded from the register file the next time they're read.
+	QuadraBlock& block = ssa_block(_gblock);
+	for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+		if(written[slot]) {
+			block.defs.erase(slot);
+			block.clobbered.insert(slot);
+		}
+	}
+}
+
+void QuadraTranslator::write_back_registers(const std::vector<bool>& observed)
+{
+	// Registers are passed between translated functions as arguments, so any
+	// of them can differ from the register file.
+	for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+		if(observed[slot]) {
+			const RegisterSlot& range = _register_slots[slot];
+			VarnodeData reg{_ghidra_register_space, range.offset, (uint4) range.size};
+			_builder.CreateStore(read_variable(slot, _gblock), get_register(reg));
+		}
+	}
+}
+
+void QuadraTranslator::scan_registers(QuadraFunction& function)
+{
+	RegisterSummary& local = function.local_registers;
+	local.read.assign(_register_slots.size(), false);
+	local.written.assign(_register_slots.size(), false);
+	VarnodeData return_reg = _arch->translate->getRegister(_arch->return_register());
+	for(const FlowBlock* block : function.ghidra->getBasicBlocks().getList()) {
+		const BlockBasic* basic = dynamic_cast<const BlockBasic*>(block);
+		for(auto iter = basic->beginOp(); iter != basic->endOp(); iter++) {
+			const PcodeOp* op = *iter;
+			for(int4 i = 0; i < op->numInput(); i++) {
+				if(op->getIn(i)->getSpace() == _ghidra_register_space) {
+					local.read[register_slot(varnode_to_varnodedata(op->getIn(i)))] = true;
+				}
+			}
+			if(op->getOut() != nullptr && op->getOut()->getSpace() == _ghidra_register_space) {
+				local.written[register_slot(varnode_to_varnodedata(op->getOut()))] = true;
+			}
+			switch(op->code()) {
+				case CPUI_CALL:
+					local.written[register_slot(return_reg)] = true;
+					break;
+				case CPUI_CALLIND:
+					local.written[register_slot(return_reg)] = true;
+					function.calls_indirectly = true;
+					break;
+				case CPUI_BRANCHIND:
+					// May fall back to a tail call, see translate_pcodeop.
+					function.calls_indirectly = true;
+					break;
+				case CPUI_CALLOTHER:
+					if(is_syscall(*op)) {
+						merge_registers(local.read, _syscall_registers.read);
+						merge_registers(local.written, _syscall_registers.written);
+					}
+					break;
+				case CPUI_RETURN:
+					local.read[register_slot(return_reg)] = true;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	function.registers = local;
+}
+
+void QuadraTranslator::update_register_summaries()
+{
+	if(!_register_summaries_dirty) {
+		return;
+	}
+	_register_summaries_dirty = false;
+	
+	std::vector<QuadraFunction*> functions;
+	for(auto& [_, function] : discovered_functions) {
+		functions.push_back(&function);
+	}
+	if(_function.ghidra != nullptr) {
+		functions.push_back(&_function);
+	}
+	
+	// Propagate from callees to callers until nothing changes, since the call
+	// graph may have cycles. Translated functions are already final. An
+	// indirect call may go to any function, so it gets the union of all of
+	// them.
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(QuadraFunction* function : functions) {
+			for(Address address : function->callees) {
+				QuadraFunction* callee = get_function(address);
+				changed |= merge_registers(function->registers.read, callee->registers.read);
+				changed |= merge_registers(function->registers.written, callee->registers.written);
+			}
+			if(function->calls_indirectly) {
+				changed |= merge_registers(function->registers.read, _indirect_registers.read);
+				changed |= merge_registers(function->registers.written, _indirect_registers.written);
+			}
+			changed |= merge_registers(_indirect_registers.read, function->registers.read);
+			changed |= merge_registers(_indirect_registers.written, function->registers.written);
+		}
+	}
+}
+
+void QuadraTranslator::declare_bodies()
+{
+	// The signatures depend on the register summaries, so this waits until
+	// every function has been discovered.
+	if(_bodies_declared) {
+		return;
+	}
+	_bodies_declared = true;
+	for(auto& [address, function] : discovered_functions) {
+		function.body = llvm::Function::Create(
+			body_type(function.registers), llvm::Function::ExternalLinkage, _function_names.at(address) + ".body", *_module);
+		function.body->setCallingConv(llvm::CallingConv::Fast);
+		_body_names[address] = function.body->getName().str();
+	}
+}
+
+llvm::FunctionType* QuadraTranslator::body_type(const RegisterSummary& registers)
+{
+	std::vector<llvm::Type*> parameters;
+	std::vector<llvm::Type*> results;
+	std::vector<bool> touched = touched_registers(registers);
+	for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+		if(touched[slot]) {
+			parameters.push_back(ssa_type(slot));
+		}
+		if(registers.written[slot]) {
+			results.push_back(ssa_type(slot));
+		}
+	}
+	return llvm::FunctionType::get(llvm::StructType::get(*_context, results), parameters, false);
+}
+
+unsigned int QuadraTranslator::body_argument(size_t slot)
+{
+	std::vector<bool> touched = touched_registers(_function.registers);
+	return std::count(touched.begin(), touched.begin() + slot, true);
+}
+
+void QuadraTranslator::create_entry_thunk()
+{
+	// Indirect calls and the host entry point don't know which registers the
+	// callee touches, so they go through this, which passes them in the
+	// register file.
+	llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*_context, "entry", _function.llvm));
+	std::vector<llvm::Value*> arguments;
+	std::vector<bool> touched = touched_registers(_function.registers);
+	for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+		if(touched[slot]) {
+			VarnodeData reg{_ghidra_register_space, _register_slots[slot].offset, (uint4) _register_slots[slot].size};
+			arguments.push_back(builder.CreateLoad(ssa_type(slot), create_pointer_to_register(reg, builder)));
+		}
+	}
+	llvm::CallInst* results = builder.CreateCall(_function.body, arguments);
+	results->setCallingConv(llvm::CallingConv::Fast);
+	unsigned int index = 0;
+	for(size_t slot = 0; slot < _register_slots.size(); slot++) {
+		if(_function.registers.written[slot]) {
+			VarnodeData reg{_ghidra_register_space, _register_slots[slot].offset, (uint4) _register_slots[slot].size};
+			builder.CreateStore(builder.CreateExtractValue(results, index++), create_pointer_to_register(reg, builder));
+		}
+	}
+	VarnodeData return_reg = _arch->translate->getRegister(_arch->return_register());
+	llvm::Value* return_value = builder.CreateLoad(int_type(return_reg.size), create_pointer_to_register(return_reg, builder));
+	builder.CreateRet(builder.CreateZExtOrTrunc(return_value, int_type(8)));
+}
+
+llvm::Function* QuadraTranslator::llvm_function()
+{
+	return _function.body != nullptr ? _function.body : _function.llvm;
+}
+
+std::string QuadraTranslator::cache_key(Address address, uint64_t size)
+{
+	ElfLoader* loader = (ElfLoader*) _arch->loader;
+	if(loader->segment_containing(address.getOffset()) == nullptr) {
+		return "";
+	}
+	std::vector<uint1> code(size);
+	loader->loadFill(code.data(), size, address);
+	
+	llvm::MD5 hash;
+	hash.update(_cache_salt);
+	hash_u64(hash, address.getOffset());
+	hash_u64(hash, size);
+	hash.update(llvm::ArrayRef<uint8_t>(code.data(), code.size()));
+	llvm::MD5::MD5Result result;
+	hash.final(result);
+	return result.digest().str().str();
+}
+
+std::string QuadraTranslator::cache_dependencies(const QuadraFunction& function)
+{
+	// Calls refer to callees by name, and which registers are written back
+	// and clobbered around them depends on their summaries.
+	llvm::MD5 hash;
+	hash.update(function.llvm->getName());
+	for(Address address : function.callees) {
+		QuadraFunction* callee = get_function(address);
+		hash.update(callee->llvm->getName());
+		hash_bits(hash, callee->registers.read);
+		hash_bits(hash, callee->registers.written);
+	}
+	if(function.calls_indirectly) {
+		hash_bits(hash, _indirect_registers.read);
+		hash_bits(hash, _indirect_registers.written);
+	}
+	llvm::MD5::MD5Result result;
+	hash.final(result);
+	return result.digest().str().str();
+}
+
+void QuadraTranslator::store_in_cache()
+{
+	// Code past the end of the symbol isn't covered by the key.
+	uint64_t begin = _function.ghidra->getAddress().getOffset();
+	uint64_t end = begin + _function.size;
+	for(const FlowBlock* block : _function.ghidra->getBasicBlocks().getList()) {
+		if(block->getStart().getOffset() < begin || block->getStop().getOffset() >= end) {
+			return;
+		}
+	}
+	
+	CachedFunction cached;
+	cached.dependencies = cache_dependencies(_function);
+	for(Address callee : _function.callees) {
+		cached.callees.push_back(callee.getOffset());
+	}
+	cached.calls_indirectly = _function.calls_indirectly;
+	cached.registers_read = _function.local_registers.read;
+	cached.registers_written = _function.local_registers.written;
+	if(_function.body != nullptr) {
+		cached.bitcode = extract_functions({_function.llvm, _function.body});
+	} else {
+		cached.bitcode = extract_functions({_function.llvm});
+	}
+	_cache->store(_function.cache_key, cached);
+}
+
+void QuadraTranslator::stream_function()
+{
+	std::vector<llvm::Function*> functions = {_function.llvm};
+	if(_function.body != nullptr) {
+		functions.push_back(_function.body);
+	}
+	std::string bitcode = extract_functions(functions);
+	std::string path = stream_path(_function.ghidra->getAddress());
+	FILE* file = fopen(path.c_str(), "wb");
+	if(file == nullptr) {
+		fprintf(stderr, "error: Failed to write %s.\n", path.c_str());
+		exit(1);
+	}
+	fwrite(bitcode.data(), 1, bitcode.size(), file);
+	bool ok = !ferror(file);
+	ok &= fclose(file) == 0;
+	if(!ok) {
+		fprintf(stderr, "error: Failed to write %s.\n", path.c_str());
+		exit(1);
+	}
+	
+	// Callers still need declarations. Globals private to the function, like
+	// its inline caches, were written out along with it.
+	std::set<llvm::GlobalValue*> globals;
+	for(llvm::Function* function : functions) {
+		for(llvm::BasicBlock& block : *function) {
+			for(llvm::Instruction& instruction : block) {
+				for(llvm::Value* operand : instruction.operands()) {
+					collect_globals(operand, globals);
+				}
+			}
+		}
+	}
+	for(llvm::Function* function : functions) {
+		function->deleteBody();
+	}
+	for(llvm::GlobalValue* global : globals) {
+		if(llvm::isa<llvm::GlobalVariable>(global) && global->hasLocalLinkage()) {
+			global->removeDeadConstantUsers(); // Left over from constant GEPs in the body.
+			if(global->use_empty()) {
+				global->eraseFromParent();
+			}
+		}
+	}
+	
+	std::lock_guard<std::mutex> lock(ghidra_mutex);
+	_function.ghidra->clear();
+}
+
+void QuadraTranslator::link_streamed_functions()
+{
+	for(auto& [address, function] : discovered_functions) {
+		if(function.cached) {
+			continue;
+		}
+		std::string path = stream_path(address);
+		llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = llvm::MemoryBuffer::getFile(path);
+		if(!buffer) {
+			fprintf(stderr, "error: Failed to read %s: %s\n", path.c_str(), buffer.getError().message().c_str());
+			exit(1);
+		}
+		llvm::Expected<std::unique_ptr<llvm::Module>> module = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), *_context);
+		if(!module) {
+			fprintf(stderr, "error: Failed to read %s: %s\n", path.c_str(), llvm::toString(module.takeError()).c_str());
+			exit(1);
+		}
+		link_module(std::move(*module));
+		remove(path.c_str());
+	}
+}
+
+std::string QuadraTranslator::stream_path(Address address)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%lx.bc", address.getOffset());
+	return (fs::path(_options.stream_directory) / name).string();
+}
+
+static void hash_u64(llvm::MD5& hash, uint64_t value)
+{
+	uint8_t bytes[8];
+	for(int i = 0; i < 8; i++) {
+		bytes[i] = value >> (i * 8);
+	}
+	hash.update(bytes);
+}
+
+static void hash_bits(llvm::MD5& hash, const std::vector<bool>& bits)
+{
+	hash_u64(hash, bits.size());
+	for(bool bit : bits) {
+		hash.update((uint8_t) bit);
+	}
+}
+
+static void collect_globals(llvm::Value* value, std::set<llvm::GlobalValue*>& globals)
+{
+	if(llvm::GlobalValue* global = llvm::dyn_cast<llvm::GlobalValue>(value)) {
+		globals.insert(global);
+	} else if(llvm::Constant* constant = llvm::dyn_cast<llvm::Constant>(value)) {
+		for(llvm::Value* operand : constant->operands()) {
+			collect_globals(operand, globals);
+		}
+	}
+}
+
+// Copy functions into a module of their own, with declarations of the
+// functions and globals they use, and return it as bitcode.
+static std::string extract_functions(llvm::ArrayRef<llvm::Function*> functions)
+{
+	std::set<llvm::GlobalValue*> globals;
+	for(llvm::Function* function : functions) {
+		for(llvm::BasicBlock& block : *function) {
+			for(llvm::Instruction& instruction : block) {
+				for(llvm::Value* operand : instruction.operands()) {
+					collect_globals(operand, globals);
+				}
+			}
+		}
+	}
+	
+	llvm::Module module("cache", functions[0]->getContext());
+	module.setDataLayout(functions[0]->getParent()->getDataLayout());
+	module.setTargetTriple(functions[0]->getParent()->getTargetTriple());
+	llvm::ValueToValueMapTy values;
+	for(llvm::Function* function : functions) {
+		llvm::Function* copy = llvm::Function::Create(
+			function->getFunctionType(), llvm::Function::ExternalLinkage, function->getName(), module);
+		copy->copyAttributesFrom(function);
+		values[function] = copy;
+		auto copy_arg = copy->arg_begin();
+		for(llvm::Argument& arg : function->args()) {
+			values[&arg] = &*copy_arg++;
+		}
+	}
+	for(llvm::GlobalValue* global : globals) {
+		if(llvm::GlobalVariable* variable = llvm::dyn_cast<llvm::GlobalVariable>(global)) {
+			// Globals private to the function, like the inline caches for
+			// indirect calls, go along with it. Their initializers don't refer
+			// to other globals.
+			bool local = variable->hasLocalLinkage();
+			values[variable] = new llvm::GlobalVariable(
+				module,
+				variable->getValueType(),
+				variable->isConstant(),
+				local ? variable->getLinkage() : llvm::GlobalValue::ExternalLinkage,
+				local ? variable->getInitializer() : nullptr,
+				variable->getName());
+		} else if(llvm::Function* callee = llvm::dyn_cast<llvm::Function>(global)) {
+			if(values.count(callee)) {
+				continue;
+			}
+			llvm::Function* declaration = llvm::Function::Create(
+				callee->getFunctionType(), llvm::Function::ExternalLinkage, callee->getName(), module);
+			declaration->copyAttributesFrom(callee);
+			values[callee] = declaration;
+		}
+	}
+	for(llvm::Function* function : functions) {
+		llvm::Function* copy = llvm::cast<llvm::Function>(values[function]);
+		llvm::SmallVector<llvm::ReturnInst*, 8> returns;
+		llvm::CloneFunctionInto(copy, function, values, llvm::CloneFunctionChangeType::DifferentModule, returns);
+	}
+	// Cloning into another module always adds this, even without any debug
+	// info, and the bitcode reader complains about it.
+	llvm::NamedMDNode* compile_units = module.getNamedMetadata("llvm.dbg.cu");
+	if(compile_units != nullptr && compile_units->getNumOperands() == 0) {
+		module.eraseNamedMetadata(compile_units);
+	}
+	
+	std::string bitcode;
+	llvm::raw_string_ostream stream(bitcode);
+	llvm::WriteBitcodeToFile(module, stream, true);
+	stream.flush();
+	return bitcode;
+}
+
+void QuadraTranslator::position_at_end(llvm::IRBuilder<>& builder, const BlockBasic* gblock)
+{
+	QuadraBlock& block = ssa_block(gblock);
+	if(!block.filled) {
+		assert(gblock == _gblock);
+		builder.SetInsertPoint(_builder.GetInsertBlock(), _builder.GetInsertPoint());
+	} else {
+		builder.SetInsertPoint(block.exit->getTerminator());
+	}
+}
+
+llvm::Value* QuadraTranslator::overflow_flag(llvm::Intrinsic::ID id, llvm::Value* lhs, llvm::Value* rhs, int4 bytes)
+{
+	llvm::Value* result = _builder.CreateBinaryIntrinsic(id, lhs, rhs);
+	return _builder.CreateZExt(_builder.CreateExtractValue(result, 1), int_type(bytes));
+}
+
+llvm::Type* QuadraTranslator::float_type(int4 bytes)
+{
+	switch(bytes) {
+		case 4: return llvm::Type::getFloatTy(*_context);
+		case 8: return llvm::Type::getDoubleTy(*_context);
+		case 10: return llvm::Type::getX86_FP80Ty(*_context);
+		case 16: return llvm::Type::getFP128Ty(*_context);
+	}
+	fprintf(stderr, "error: No floating point type is %d bytes.\n", bytes);
+	exit(1);
+}
+
+llvm::Value* QuadraTranslator::to_float(llvm::Value* value)
+{
+	return _builder.CreateBitCast(value, float_type(value->getType()->getIntegerBitWidth() / 8));
+}
+
+llvm::Value* QuadraTranslator::from_float(llvm::Value* value)
+{
+	return _builder.CreateBitCast(value, int_type(value->getType()->getPrimitiveSizeInBits() / 8));
+}
+
 llvm::Value* QuadraTranslator::zero(int4 bytes)
 {
 	return llvm::ConstantInt::get(int_type(bytes), llvm::APInt(bytes * 8, 0, false));
@@ -491,18 +2104,18 @@ llvm::Value* QuadraTranslator::zero(int4 bytes)
 
 llvm::Type* QuadraTranslator::int_type(int4 bytes)
 {
-	return llvm::IntegerType::get(_context, bytes * 8);
+	return llvm::IntegerType::get(*_context, bytes * 8);
 }
 
 void QuadraTranslator::create_printf_int(const char* fmt, llvm::Value* val)
 {
 	// https://stackoverflow.com/questions/30234027/how-to-call-printf-in-llvm-through-the-module-builder-system
-	llvm::Function* printf = _module.getFunction("printf");
+	llvm::Function* printf = _module->getFunction("printf");
 	if(printf == nullptr) {
-		llvm::PointerType *Pty = llvm::PointerType::get(llvm::IntegerType::get(_module.getContext(), 8), 0);
-		llvm::FunctionType *FuncTy9 = llvm::FunctionType::get(llvm::IntegerType::get(_module.getContext(), 32), true);
+		llvm::PointerType *Pty = llvm::PointerType::get(llvm::IntegerType::get(_module->getContext(), 8), 0);
+		llvm::FunctionType *FuncTy9 = llvm::FunctionType::get(llvm::IntegerType::get(_module->getContext(), 32), true);
 
-		printf = llvm::Function::Create(FuncTy9, llvm::GlobalValue::ExternalLinkage, "printf", &_module);
+		printf = llvm::Function::Create(FuncTy9, llvm::GlobalValue::ExternalLinkage, "printf", _module.get());
 		printf->setCallingConv(llvm::CallingConv::C);
 
 		llvm::AttributeList printf_attr_list;
@@ -511,7 +2124,150 @@ void QuadraTranslator::create_printf_int(const char* fmt, llvm::Value* val)
 	
 	llvm::Value* args[2] = { _builder.CreateGlobalStringPtr(fmt), val };
 	llvm::ArrayRef<llvm::Value*> args_ref(args, args + 2);
-	_builder.CreateCall(_module.getFunction("printf"), args_ref);
+	_builder.CreateCall(_module->getFunction("printf"), args_ref);
+}
+
+void QuadraTranslator::create_userop_table()
+{
+	// User-ops are numbered by SLEIGH, so look the ones we know about up by
+	// name.
+	std::string syscall = _arch->syscall_userop();
+	std::map<std::string, VectorUserOpInfo> vector_userops = _arch->vector_userops();
+	for(int4 i = 0; i < _arch->userops.numOps(); i++) {
+		UserPcodeOp* userop = _arch->userops.getOp(i);
+		if(userop == nullptr) {
+			continue;
+		}
+		if(userop->getName() == syscall) {
+			_userops[i] = {UserOpKind::SYSCALL};
+			continue;
+		}
+		auto iter = vector_userops.find(userop->getName());
+		if(iter != vector_userops.end()) {
+			_userops[i] = {UserOpKind::VECTOR, iter->second};
+		}
+	}
+}
+
+bool QuadraTranslator::is_syscall(const PcodeOp& op)
+{
+	auto iter = _userops.find(op.getIn(0)->getOffset());
+	return iter != _userops.end() && iter->second.kind == UserOpKind::SYSCALL;
+}
+
+void QuadraTranslator::translate_userop(const PcodeOp& op, llvm::ArrayRef<llvm::Value*> inputs)
+{
+	int4 index = op.getIn(0)->getOffset();
+	auto iter = _userops.find(index);
+	if(iter == _userops.end()) {
+		// Things like cache maintenance and sync instructions don't matter to
+		// a translated program, so unknown user-ops are dropped.
+		if(_unsupported_userops.insert(index).second) {
+			UserPcodeOp* userop = _arch->userops.getOp(index);
+			fprintf(stderr, "warning: Ignoring unsupported user-op %s.\n", userop ? userop->getName().c_str() : "?");
+		}
+		if(op.getOut() != nullptr) {
+			set_output(op.getOut(), zero(op.getOut()->getSize()));
+		}
+		return;
+	}
+	
+	switch(iter->second.kind) {
+		case UserOpKind::SYSCALL:
+			if(_options.ssa && translate_direct_syscall()) {
+				return;
+			}
+			if(_options.ssa) {
+				write_back_registers(touched_registers(_syscall_registers));
+			}
+			_builder.CreateCall(_syscall_dispatcher);
+			if(_options.ssa) {
+				clobber_registers(_syscall_registers.written);
+			}
+			break;
+		case UserOpKind::VECTOR:
+			assert(op.getOut() != nullptr);
+			set_output(op.getOut(), translate_vector_userop(iter->second.vector, inputs.drop_front(), op.getOut()->getSize()));
+			break;
+	}
+}
+
+llvm::Value* QuadraTranslator::translate_vector_userop(const VectorUserOpInfo& userop, llvm::ArrayRef<llvm::Value*> operands, int4 size)
+{
+	// Registers are plain integers, so operands are bitcast to vectors and the
+	// result is bitcast back. Lane 0 is the least significant, which is only
+	// right for little endian guests.
+	int4 lanes = size * 8 / userop.lane_bits;
+	llvm::Type* lane_type = int_type(userop.lane_bits / 8);
+	if(userop.floating) {
+		lane_type = userop.lane_bits == 32 ? llvm::Type::getFloatTy(*_context) : llvm::Type::getDoubleTy(*_context);
+	}
+	llvm::VectorType* vector_type = llvm::FixedVectorType::get(lane_type, lanes);
+	std::vector<llvm::Value*> vectors;
+	for(llvm::Value* operand : operands) {
+		vectors.push_back(_builder.CreateBitCast(_builder.CreateZExtOrTrunc(operand, int_type(size)), vector_type));
+	}
+	assert(vectors.size() >= 1);
+	llvm::Value* a = vectors[0];
+	llvm::Value* b = vectors.size() >= 2 ? vectors[1] : nullptr;
+	
+	// Wider lanes for ops that need the carry or the high half.
+	llvm::VectorType* wide_type = llvm::FixedVectorType::get(int_type(userop.lane_bits / 4), lanes);
+	llvm::Value* result = nullptr;
+	switch(userop.op) {
+		case VectorOp::ADD: result = _builder.CreateAdd(a, b); break;
+		case VectorOp::SUB: result = _builder.CreateSub(a, b); break;
+		case VectorOp::ADD_SAT: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::sadd_sat, a, b); break;
+		case VectorOp::ADD_USAT: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::uadd_sat, a, b); break;
+		case VectorOp::SUB_SAT: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::ssub_sat, a, b); break;
+		case VectorOp::SUB_USAT: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::usub_sat, a, b); break;
+		case VectorOp::MIN: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, a, b); break;
+		case VectorOp::MAX: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::smax, a, b); break;
+		case VectorOp::UMIN: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::umin, a, b); break;
+		case VectorOp::UMAX: result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, a, b); break;
+		case VectorOp::ABS_SAT: {
+			llvm::Value* abs = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::abs, a, _builder.getFalse());
+			llvm::Value* int_max = llvm::ConstantInt::get(vector_type, llvm::APInt::getSignedMaxValue(userop.lane_bits));
+			result = _builder.CreateBinaryIntrinsic(llvm::Intrinsic::umin, abs, int_max);
+			break;
+		}
+		case VectorOp::AND: result = _builder.CreateAnd(a, b); break;
+		case VectorOp::OR: result = _builder.CreateOr(a, b); break;
+		case VectorOp::XOR: result = _builder.CreateXor(a, b); break;
+		case VectorOp::NOR: result = _builder.CreateNot(_builder.CreateOr(a, b)); break;
+		case VectorOp::EQUAL: result = _builder.CreateSExt(_builder.CreateICmpEQ(a, b), vector_type); break;
+		case VectorOp::GREATER: result = _builder.CreateSExt(_builder.CreateICmpSGT(a, b), vector_type); break;
+		case VectorOp::UAVG: {
+			llvm::Value* sum = _builder.CreateAdd(_builder.CreateZExt(a, wide_type), _builder.CreateZExt(b, wide_type));
+			sum = _builder.CreateAdd(sum, llvm::ConstantInt::get(wide_type, 1));
+			result = _builder.CreateTrunc(_builder.CreateLShr(sum, 1), vector_type);
+			break;
+		}
+		case VectorOp::MULHI:
+		case VectorOp::UMULHI: {
+			bool is_signed = userop.op == VectorOp::MULHI;
+			llvm::Value* product = _builder.CreateMul(
+				_builder.CreateIntCast(a, wide_type, is_signed),
+				_builder.CreateIntCast(b, wide_type, is_signed));
+			result = _builder.CreateTrunc(_builder.CreateLShr(product, userop.lane_bits), vector_type);
+			break;
+		}
+		case VectorOp::MADD_PAIRS: {
+			// Half as many lanes, each twice as wide.
+			llvm::Value* product = _builder.CreateMul(_builder.CreateSExt(a, wide_type), _builder.CreateSExt(b, wide_type));
+			std::vector<int> even, odd;
+			for(int4 i = 0; i < lanes; i += 2) {
+				even.push_back(i);
+				odd.push_back(i + 1);
+			}
+			result = _builder.CreateAdd(_builder.CreateShuffleVector(product, even), _builder.CreateShuffleVector(product, odd));
+			break;
+		}
+		case VectorOp::FMIN: result = _builder.CreateSelect(_builder.CreateFCmpOLT(a, b), a, b); break;
+		case VectorOp::FMAX: result = _builder.CreateSelect(_builder.CreateFCmpOGT(a, b), a, b); break;
+		case VectorOp::FSQRT: result = _builder.CreateUnaryIntrinsic(llvm::Intrinsic::sqrt, a); break;
+	}
+	return _builder.CreateBitCast(result, int_type(size));
 }
 
 llvm::Function* QuadraTranslator::create_syscall_dispatcher()
@@ -519,79 +2275,434 @@ llvm::Function* QuadraTranslator::create_syscall_dispatcher()
 	//DocumentStorage doc_store;
 	//Document* languages_xml = doc_store.openDocument("syscalls/languages.xml");
 	
-	llvm::FunctionType* func_type = llvm::FunctionType::get(llvm::Type::getInt32Ty(_context), false);
+	llvm::FunctionType* func_type = llvm::FunctionType::get(llvm::Type::getInt32Ty(*_context), false);
 	llvm::Function* dispatcher = llvm::Function::Create(
 		func_type,
 		llvm::Function::ExternalLinkage,
 		"__quadra_dispatch_syscall",
-		_module);
+		*_module);
 	
-	llvm::BasicBlock* entry = llvm::BasicBlock::Create(_context, "entry", dispatcher);
+	llvm::BasicBlock* entry = llvm::BasicBlock::Create(*_context, "entry", dispatcher);
 	_builder.SetInsertPoint(entry);
 	
 	std::vector<std::string> arg_reg_names = _arch->syscall_argument_registers();
 	std::vector<llvm::Value*> arg_regs;
+	std::vector<int4> arg_reg_sizes;
 	for(auto& name : arg_reg_names) {
 		VarnodeData reg = _arch->translate->getRegister(name);
 		arg_regs.push_back(create_pointer_to_register(reg, _builder));
+		arg_reg_sizes.push_back(reg.size);
 	}
-	llvm::Type* char_type = llvm::Type::getInt8Ty(_context);
-	llvm::Type* u32_type = llvm::Type::getInt32Ty(_context);
-	llvm::Type* char_ptr_type = llvm::PointerType::get(char_type, _register_space);
-	
-	auto to_llvm_type = [&](PrimtiveType type) {
-		switch(type) {
-			case PT_U32: return u32_type;
-			case PT_CHAR_PTR: return char_ptr_type;
-		}
-		assert(0);
-	};
 	
-	// Used to get the stack pointer.
-	llvm::AllocaInst* dummy_alloca = _builder.CreateAlloca(int_type(1), nullptr, "stackframe");
+	llvm::Value* memory_base = nullptr;
+	if(_flat_memory) {
+		memory_base = _builder.CreateLoad(_memory_base_global->getValueType(), _memory_base_global, "memory_base");
+	}
 	
 	VarnodeData syscall_number_reg = _arch->translate->getRegister(_arch->syscall_return_register());
 	llvm::Value* v0_ptr = create_pointer_to_register(syscall_number_reg, _builder);
-	auto syscall_number = _builder.CreateLoad(v0_ptr);
+	auto syscall_number = _builder.CreateLoad(int_type(syscall_number_reg.size), v0_ptr);
 	
-	for(auto& [number, syscall] : _arch->syscalls()) {
-		llvm::Value* number_val = llvm::ConstantInt::get(_context, llvm::APInt(32, number, false));
-		auto cond = _builder.CreateICmpEQ(syscall_number, number_val, "cmp");
+	// Unknown syscalls fall through to the default case and do nothing.
+	std::map<int, SyscallInfo> syscalls = _arch->syscalls();
+	llvm::BasicBlock* done = llvm::BasicBlock::Create(*_context, "done", dispatcher);
+	llvm::SwitchInst* cases = _builder.CreateSwitch(syscall_number, done, syscalls.size());
+	for(auto& [number, syscall] : syscalls) {
+		llvm::BasicBlock* block = llvm::BasicBlock::Create(*_context, "sys_" + std::to_string(number), dispatcher);
+		cases->addCase(llvm::ConstantInt::get(*_context, llvm::APInt(syscall_number_reg.size * 8, number, true)), block);
 		
-		llvm::BasicBlock* truthy = llvm::BasicBlock::Create(_context, "sys_" + std::to_string(number), dispatcher);
-		llvm::BasicBlock* continuation = llvm::BasicBlock::Create(_context, "", dispatcher);
-		_builder.CreateCondBr(cond, truthy, continuation);
+		_builder.SetInsertPoint(block);
+		std::vector<llvm::Value*> args;
+		for(size_t i = 0; i < syscall.argument_types.size(); i++) {
+			args.push_back(_builder.CreateLoad(int_type(arg_reg_sizes[i]), arg_regs[i]));
+		}
+		llvm::Value* result = call_syscall(syscall, args, memory_base);
+		_builder.CreateStore(_builder.CreateZExtOrTrunc(result, int_type(syscall_number_reg.size)), v0_ptr, false);
+		_builder.CreateBr(done);
+	}
+	
+	_builder.SetInsertPoint(done);
+	_builder.CreateRet(llvm::ConstantInt::get(*_context, llvm::APInt(32, 0, false)));
+	
+	return dispatcher;
+}
+
+bool QuadraTranslator::translate_direct_syscall()
+{
+	// The usual li v0, <number>; syscall sequence leaves a constant in the
+	// number register, so the wrapper can be called straight from the
+	// argument registers' SSA values without going through the register
+	// file.
+	VarnodeData syscall_number_reg = _arch->translate->getRegister(_arch->syscall_return_register());
+	llvm::KnownBits number = llvm::computeKnownBits(read_register(syscall_number_reg), _module->getDataLayout());
+	if(!number.isConstant()) {
+		return false;
+	}
+	std::map<int, SyscallInfo> syscalls = _arch->syscalls();
+	auto iter = syscalls.find(number.getConstant().getSExtValue());
+	if(iter == syscalls.end()) {
+		return false;
+	}
+	
+	const SyscallInfo& syscall = iter->second;
+	std::vector<std::string> arg_reg_names = _arch->syscall_argument_registers();
+	std::vector<llvm::Value*> args;
+	for(size_t i = 0; i < syscall.argument_types.size(); i++) {
+		args.push_back(read_register(_arch->translate->getRegister(arg_reg_names[i])));
+	}
+	llvm::Value* result = call_syscall(syscall, args, _function.memory_base);
+	write_register(syscall_number_reg, _builder.CreateZExtOrTrunc(result, int_type(syscall_number_reg.size)));
+	return true;
+}
+
+llvm::Value* QuadraTranslator::call_syscall(const SyscallInfo& syscall, const std::vector<llvm::Value*>& arg_regs, llvm::Value* memory_base)
+{
+	std::vector<llvm::Value*> args;
+	for(size_t i = 0; i < syscall.argument_types.size(); i++) {
+		llvm::Type* arg_type = syscall_type(syscall.argument_types[i]);
+		if(arg_type->isPointerTy()) {
+			args.push_back(guest_pointer(arg_regs[i], arg_type, memory_base));
+		} else {
+			args.push_back(_builder.CreateZExtOrTrunc(arg_regs[i], arg_type));
+		}
+	}
+	return _builder.CreateCall(get_syscall_wrapper(syscall), args);
+}
+
+llvm::Function* QuadraTranslator::get_syscall_wrapper(const SyscallInfo& syscall)
+{
+	llvm::Function* wrapper = _module->getFunction(syscall.symbol);
+	if(wrapper != nullptr) {
+		return wrapper;
+	}
+	std::vector<llvm::Type*> arg_types;
+	for(PrimtiveType type : syscall.argument_types) {
+		arg_types.push_back(syscall_type(type));
+	}
+	llvm::FunctionType* wrapper_type = llvm::FunctionType::get(syscall_type(syscall.return_type), arg_types, false);
+	return llvm::Function::Create(wrapper_type, llvm::GlobalValue::ExternalLinkage, syscall.symbol, *_module);
+}
+
+llvm::Type* QuadraTranslator::syscall_type(PrimtiveType type)
+{
+	switch(type) {
+		case PT_U32: return llvm::Type::getInt32Ty(*_context);
+		case PT_CHAR_PTR: return llvm::PointerType::get(llvm::Type::getInt8Ty(*_context), _register_space);
+	}
+	assert(0);
+}
+
+void QuadraTranslator::create_segment_globals()
+{
+	ElfLoader* loader = (ElfLoader*) _arch->loader;
+	for(const ElfProgramHeader64* header : loader->load_segments()) {
+		// Read-only segments are emitted as constants covering their whole
+		// memory image, so that LLVM can fold loads from string tables, lookup
+		// tables and the like. Writable segments are only kept as the initial
+		// contents the runtime copies into guest memory, since that's the one
+		// copy that stores have to go to.
+		bool writable = (header->flags & PF_W) != 0;
+		if(writable && header->filesz == 0) {
+			continue;
+		}
+		QuadraSegment& segment = _segments.emplace_back();
+		segment.vaddr = header->vaddr;
+		segment.size = writable ? header->filesz : header->memsz;
+		segment.writable = writable;
 		
-		std::vector<llvm::Type*> arg_types;
-		for(PrimtiveType type : syscall.argument_types) {
-			arg_types.push_back(to_llvm_type(type));
+		// Workers only reference the segments, the data is in the parent.
+		llvm::Constant* initializer = nullptr;
+		if(_parent == nullptr) {
+			std::vector<uint8_t> data(segment.size, 0);
+			memcpy(data.data(), loader->segment_data(*header), std::min(header->filesz, segment.size));
+			initializer = llvm::ConstantDataArray::get(*_context, data);
 		}
-		llvm::FunctionType* wrapper_type = llvm::FunctionType::get(to_llvm_type(syscall.return_type), arg_types, false);
-		llvm::Function* wrapper = llvm::Function::Create(
-			wrapper_type,
+		std::stringstream name;
+		name << "segment_" << std::hex << header->vaddr;
+		segment.global = new llvm::GlobalVariable(
+			*_module,
+			llvm::ArrayType::get(int_type(1), segment.size),
+			!segment.writable,
 			llvm::GlobalValue::ExternalLinkage,
-			syscall.symbol,
-			_module);
-		
-		_builder.SetInsertPoint(truthy);
-		std::vector<llvm::Value*> args;
-		for(int i = 0; i < syscall.argument_types.size(); i++) {
-			llvm::Value* arg = _builder.CreateLoad(arg_regs[i]);
-			llvm::Type* arg_type = to_llvm_type(syscall.argument_types[i]);
-			if(arg_type->isPointerTy()) {
-				arg = decompress_pointer(arg, dummy_alloca, arg_type);
-			} else {
-				arg = _builder.CreateZExtOrTrunc(arg, to_llvm_type(syscall.argument_types[i]));
+			initializer,
+			name.str());
+	}
+}
+
+void QuadraTranslator::create_function_table()
+{
+	// By the time main is created every function has been discovered, so
+	// the table is complete. Declarations are replaced by definitions when
+	// they're linked in, which updates the table too.
+	llvm::Type* address_type = int_type(8);
+	llvm::PointerType* host_type = llvm::Type::getInt8PtrTy(*_context);
+	llvm::StructType* entry_type = llvm::StructType::get(*_context, {address_type, host_type});
+	std::vector<llvm::Constant*> entries;
+	for(auto& [address, function] : discovered_functions) {
+		entries.push_back(llvm::ConstantStruct::get(entry_type, {
+			llvm::ConstantInt::get(address_type, address.getOffset()),
+			llvm::ConstantExpr::getPointerCast(function.llvm, host_type)
+		}));
+	}
+	auto table_type = llvm::ArrayType::get(entry_type, entries.size());
+	llvm::GlobalVariable* table = new llvm::GlobalVariable(
+		*_module,
+		table_type,
+		true,
+		llvm::GlobalValue::InternalLinkage,
+		llvm::ConstantArray::get(table_type, entries),
+		"__quadra_functions");
+	
+	// The table is sorted by address since discovered_functions is, so the
+	// runtime can binary search it.
+	llvm::Function* finder = function_finder();
+	llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*_context, "entry", finder));
+	llvm::FunctionType* lookup_type = llvm::FunctionType::get(host_type, {host_type, address_type, address_type}, false);
+	llvm::FunctionCallee lookup = _module->getOrInsertFunction("__quadra_lookup_function", lookup_type);
+	builder.CreateRet(builder.CreateCall(lookup, {
+		builder.CreatePointerCast(table, host_type),
+		llvm::ConstantInt::get(address_type, entries.size()),
+		finder->getArg(0)
+	}));
+}
+
+void QuadraTranslator::create_profile_counters()
+{
+	// Each counter carries its guest address along with it, so a function's
+	// counters can be cached or linked in from a worker on their own. The
+	// fields match struct QuadraCounter in the runtime.
+	llvm::Type* field_type = int_type(8);
+	llvm::StructType* counter_type = llvm::StructType::get(*_context, {field_type, field_type, field_type, field_type});
+	std::vector<llvm::Constant*> counters;
+	auto add_counter = [&](uint64_t kind, uint64_t address, uint64_t target) {
+		counters.push_back(llvm::ConstantStruct::get(counter_type, {
+			llvm::ConstantInt::get(field_type, kind),
+			llvm::ConstantInt::get(field_type, address),
+			llvm::ConstantInt::get(field_type, target),
+			llvm::ConstantInt::get(field_type, 0)
+		}));
+	};
+	const BlockGraph& blocks = _function.ghidra->getBasicBlocks();
+	for(int4 i = 0; i < blocks.getSize(); i++) {
+		assert(blocks.getBlock(i)->getIndex() == i);
+		add_counter(QUADRA_COUNTER_BLOCK, blocks.getBlock(i)->getStart().getOffset(), 0);
+	}
+	_call_counters.clear();
+	for(const FlowBlock* block : blocks.getList()) {
+		const BlockBasic* basic = dynamic_cast<const BlockBasic*>(block);
+		for(auto iter = basic->beginOp(); iter != basic->endOp(); iter++) {
+			const PcodeOp* op = *iter;
+			if(op->code() == CPUI_CALL) {
+				_call_counters[op] = counters.size();
+				Address callee = _function.ghidra->getCallSpecs(op)->getEntryAddress();
+				add_counter(QUADRA_COUNTER_CALL, op->getAddr().getOffset(), callee.getOffset());
 			}
-			args.push_back(arg);
 		}
-		auto result = _builder.CreateCall(wrapper, args);
-		_builder.CreateStore(result, v0_ptr, false);
-		_builder.CreateBr(continuation);
-		_builder.SetInsertPoint(continuation);
 	}
 	
-	_builder.CreateRet(llvm::ConstantInt::get(_context, llvm::APInt(32, 0, false)));
+	auto counters_type = llvm::ArrayType::get(counter_type, counters.size());
+	_profile_counters = new llvm::GlobalVariable(
+		*_module,
+		counters_type,
+		false,
+		llvm::GlobalValue::InternalLinkage,
+		llvm::ConstantArray::get(counters_type, counters),
+		_function.llvm->getName() + ".profile");
+}
+
+void QuadraTranslator::increment_counter(size_t index)
+{
+	llvm::Type* type = int_type(8);
+	llvm::Value* count_ptr = _builder.CreateConstInBoundsGEP2_32(
+		_profile_counters->getValueType(), _profile_counters, 0, index);
+	count_ptr = _builder.CreateStructGEP(
+		_profile_counters->getValueType()->getArrayElementType(), count_ptr, 3);
+	llvm::Value* count = _builder.CreateLoad(type, count_ptr);
+	_builder.CreateStore(_builder.CreateAdd(count, llvm::ConstantInt::get(type, 1)), count_ptr);
+}
+
+void QuadraTranslator::create_profile_table()
+{
+	// The counters live alongside the functions, wherever they were
+	// translated, so the table is built once they've all been linked in. The
+	// entries match struct QuadraProfileFunction in the runtime.
+	llvm::Type* field_type = int_type(8);
+	llvm::PointerType* pointer_type = llvm::Type::getInt8PtrTy(*_context);
+	llvm::StructType* entry_type = llvm::StructType::get(*_context, {field_type, pointer_type, field_type, pointer_type});
+	std::vector<llvm::Constant*> entries;
+	for(auto& [address, function] : discovered_functions) {
+		std::string name = _function_names.at(address);
+		llvm::GlobalVariable* counters = _module->getNamedGlobal(name + ".profile");
+		if(counters == nullptr) {
+			continue;
+		}
+		llvm::Constant* name_constant = llvm::ConstantDataArray::getString(*_context, name);
+		llvm::GlobalVariable* name_global = new llvm::GlobalVariable(
+			*_module,
+			name_constant->getType(),
+			true,
+			llvm::GlobalValue::PrivateLinkage,
+			name_constant,
+			name + ".profile_name");
+		entries.push_back(llvm::ConstantStruct::get(entry_type, {
+			llvm::ConstantInt::get(field_type, address.getOffset()),
+			llvm::ConstantExpr::getPointerCast(name_global, pointer_type),
+			llvm::ConstantInt::get(field_type, counters->getValueType()->getArrayNumElements()),
+			llvm::ConstantExpr::getPointerCast(counters, pointer_type)
+		}));
+	}
+	auto table_type = llvm::ArrayType::get(entry_type, entries.size());
+	llvm::GlobalVariable* table = new llvm::GlobalVariable(
+		*_module,
+		table_type,
+		true,
+		llvm::GlobalValue::InternalLinkage,
+		llvm::ConstantArray::get(table_type, entries),
+		"__quadra_profile");
+	
+	// The runtime writes the counters out when the program exits.
+	assert(_main != nullptr && "The profile table needs main to have been created!");
+	llvm::IRBuilder<> builder(&_main->getEntryBlock(), _main->getEntryBlock().getFirstInsertionPt());
+	llvm::FunctionType* init_type = llvm::FunctionType::get(llvm::Type::getVoidTy(*_context), {pointer_type, field_type}, false);
+	llvm::FunctionCallee init = _module->getOrInsertFunction("__quadra_init_profile", init_type);
+	builder.CreateCall(init, {
+		builder.CreatePointerCast(table, pointer_type),
+		llvm::ConstantInt::get(field_type, entries.size())
+	});
 	
-	return dispatcher;
+	// Also if it returns from its entry point instead of calling exit.
+	builder.SetInsertPoint(_main->getEntryBlock().getTerminator());
+	builder.CreateCall(_module->getOrInsertFunction("__quadra_write_profile", llvm::Type::getVoidTy(*_context)));
+}
+
+uint64_t QuadraTranslator::block_count(const FlowBlock* gblock)
+{
+	return _profile->count(gblock->getStart().getOffset(), gblock->getStop().getOffset());
+}
+
+llvm::MDNode* QuadraTranslator::branch_weights(const BlockBasic* from, const std::vector<const FlowBlock*>& to)
+{
+	if(_profile == nullptr) {
+		return nullptr;
+	}
+	
+	// The profile only counts blocks, so edges are worked out from them. A
+	// block with a single predecessor is only entered through that edge,
+	// unless it's the function's entry. If there's only one other edge it
+	// takes the rest of the count, and otherwise the count of the block it
+	// goes to is the best guess. A null block is an edge that's never taken.
+	const FlowBlock* entry = _function.ghidra->getBasicBlocks().getList()[0];
+	uint64_t total = block_count(from);
+	std::vector<uint64_t> counts(to.size());
+	std::vector<size_t> unknown;
+	uint64_t known = 0;
+	for(size_t i = 0; i < to.size(); i++) {
+		if(to[i] == nullptr) {
+			counts[i] = 0;
+		} else if(to[i]->sizeIn() == 1 && to[i] != entry) {
+			counts[i] = block_count(to[i]);
+			known += counts[i];
+		} else {
+			unknown.push_back(i);
+		}
+	}
+	if(unknown.size() == 1) {
+		counts[unknown[0]] = total > known ? total - known : 0;
+	} else {
+		for(size_t i : unknown) {
+			counts[i] = std::min(block_count(to[i]), total);
+		}
+	}
+	
+	// Weights are 32-bit, so big counts are scaled down like clang does.
+	// Adding one keeps edges that were never taken from looking impossible.
+	uint64_t max_count = *std::max_element(counts.begin(), counts.end());
+	uint64_t scale = max_count / UINT32_MAX + 1;
+	std::vector<uint32_t> weights;
+	for(uint64_t count : counts) {
+		weights.push_back(count / scale + 1);
+	}
+	return llvm::MDBuilder(*_context).createBranchWeights(weights);
+}
+
+void QuadraTranslator::set_entry_counts()
+{
+	// Functions the profile never saw run get a count of zero, which marks
+	// them as cold.
+	uint64_t count = block_count(_function.ghidra->getBasicBlocks().getList()[0]);
+	llvm_function()->setEntryCount(llvm::Function::ProfileCount(count, llvm::Function::PCT_Real));
+	if(_function.body != nullptr) {
+		_function.llvm->setEntryCount(llvm::Function::ProfileCount(count, llvm::Function::PCT_Real));
+	}
+}
+
+void QuadraTranslator::set_profile_summary()
+{
+	// Without a summary LLVM doesn't know what counts as hot, so it would
+	// only use the profile for block layout.
+	// Counts are grouped into a record per function, each starting with the
+	// count of its entry.
+	llvm::InstrProfSummaryBuilder builder(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+	AddrSpace* code_space = _arch->translate->getDefaultCodeSpace();
+	llvm::InstrProfRecord record;
+	for(auto& [address, count] : _profile->counts()) {
+		if(discovered_functions.count(Address(code_space, address)) == 1 && !record.Counts.empty()) {
+			builder.addRecord(record);
+			record.Counts.clear();
+		}
+		record.Counts.push_back(count);
+	}
+	if(!record.Counts.empty()) {
+		builder.addRecord(record);
+	}
+	_module->setProfileSummary(builder.getSummary()->getMD(*_context), llvm::ProfileSummary::PSK_Instr);
+}
+
+llvm::Function* QuadraTranslator::function_finder()
+{
+	// Defined by the parent once all functions are known, and only declared
+	// by workers.
+	llvm::Function* finder = _module->getFunction("__quadra_find_function");
+	if(finder == nullptr) {
+		llvm::PointerType* host_type = llvm::Type::getInt8PtrTy(*_context);
+		llvm::FunctionType* finder_type = llvm::FunctionType::get(host_type, {int_type(8)}, false);
+		finder = llvm::Function::Create(finder_type, llvm::Function::ExternalLinkage, "__quadra_find_function", *_module);
+	}
+	return finder;
+}
+
+void QuadraTranslator::create_segment_table()
+{
+	// The runtime copies the segments into guest memory at startup, and for
+	// 32-bit guests uses the end of the last one as the initial program
+	// break. The table is passed to it by main.
+	llvm::Type* u64_type = int_type(8);
+	llvm::PointerType* data_type = llvm::Type::getInt8PtrTy(*_context);
+	llvm::StructType* entry_type = llvm::StructType::get(*_context, {u64_type, u64_type, u64_type, data_type});
+	
+	ElfLoader* loader = (ElfLoader*) _arch->loader;
+	std::vector<llvm::Constant*> entries;
+	for(const ElfProgramHeader64* header : loader->load_segments()) {
+		llvm::Constant* data = llvm::ConstantPointerNull::get(data_type);
+		for(QuadraSegment& segment : _segments) {
+			if(segment.vaddr == header->vaddr) {
+				data = llvm::ConstantExpr::getPointerCast(segment.global, data_type);
+			}
+		}
+		entries.push_back(llvm::ConstantStruct::get(entry_type, {
+			llvm::ConstantInt::get(u64_type, header->vaddr),
+			llvm::ConstantInt::get(u64_type, data->isNullValue() ? 0 : header->filesz),
+			llvm::ConstantInt::get(u64_type, header->memsz),
+			data
+		}));
+	}
+	
+	auto table_type = llvm::ArrayType::get(entry_type, entries.size());
+	_segment_table = new llvm::GlobalVariable(
+		*_module,
+		table_type,
+		true,
+		llvm::GlobalValue::InternalLinkage,
+		llvm::ConstantArray::get(table_type, entries),
+		"__quadra_segments");
 }
@@ -3,25 +3,140 @@
 
 #include <decompile/cpp/sleigh.hh>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/ValueHandle.h>
+
+#include <set>
+#include <unordered_map>
 
 #include "quadra_architecture.h"
+#include "cache.h"
+#include "pcode_optimizer.h"
+#include "profile.h"
 
 struct QuadraBlock {
-	llvm::BasicBlock* llvm;
+	llvm::BasicBlock* llvm = nullptr;
+	llvm::BasicBlock* exit = nullptr; // The LLVM block the branch out of this block ended up in.
 	bool emitted_branch = false;
+	
+	// SSA construction state, see QuadraTranslator::read_variable.
+	llvm::DenseMap<size_t, llvm::WeakTrackingVH> defs;
+	std::map<size_t, llvm::PHINode*> incomplete_phis;
+	bool filled = false;
+	bool sealed = false;
+	std::set<size_t> clobbered; // Register slots a call has clobbered since the start of the block.
+};
+
+// Varnodes are looked up once per pcode op input, so the per-function tables
+// are hashed rather than ordered.
+struct VarnodeDataHash {
+	size_t operator()(const VarnodeData& var) const {
+		return llvm::hash_combine(var.space->getIndex(), var.offset, var.size);
+	}
+};
+
+template <typename T>
+using VarnodeMap = std::unordered_map<VarnodeData, T, VarnodeDataHash>;
+
+// The register slots a function may read or write.
+struct RegisterSummary {
+	std::vector<bool> read;
+	std::vector<bool> written;
 };
 
 struct QuadraFunction {
-	Funcdata* ghidra;
-	llvm::Function* llvm = nullptr;
-	std::map<const Varnode*, llvm::AllocaInst*> locals;
+	Funcdata* ghidra = nullptr;
+	uint64_t size = 0; // Size from the symbol table, or zero if unknown.
+	llvm::Function* llvm = nullptr; // Takes and returns registers in the register file.
+	
+	// In SSA mode the pcode is translated into this instead. It takes every
+	// register the function touches as an argument and returns those it may
+	// write, so direct calls keep them in host registers, and the llvm
+	// function is a thunk that calls it.
+	llvm::Function* body = nullptr;
+	VarnodeMap<llvm::AllocaInst*> locals;
 	llvm::Value* register_alloca = nullptr;
-	unsigned int stack_space = 0;
-	llvm::Value* stack_alloca = nullptr;
-	std::map<VarnodeData, llvm::Value*> register_pointers;
+	llvm::Value* memory_base = nullptr;
+	VarnodeMap<llvm::Value*> register_pointers;
+	
+	// In SSA mode, a virtual predecessor of the first block that provides the
+	// values of variables on entry.
+	QuadraBlock entry;
+	VarnodeMap<size_t> ssa_variables; // Non-register varnodes.
+	std::vector<int4> ssa_variable_sizes;
+	
+	// In SSA mode registers are only written back to the register file where
+	// a callee or syscall can observe them.
+	std::vector<Address> callees;
+	bool calls_indirectly = false; // Has a CALLIND, which may reach any function.
+	RegisterSummary local_registers; // Accessed by the function's own pcode.
+	RegisterSummary registers; // Including everything it calls.
+	
+	std::string cache_key; // Empty if the function can't be cached.
+	bool cached = false; // Loaded from the cache, so there's nothing to translate.
+};
+
+// A range of the register space covering a set of overlapping registers e.g.
+// v0 and v0_lo. In SSA mode each slot is a single variable, so that writes
+// to a register are seen by reads of the registers overlapping it.
+struct RegisterSlot {
+	uintb offset;
+	uint4 size; // Like VarnodeData::size.
+};
+
+struct QuadraTranslatorOptions {
+	// Map register and unique varnodes directly to SSA values, instead of
+	// going through an alloca or the register file for each access.
+	bool ssa = true;
+	
+	// Assume floating point code never sees NaNs, infinities or denormals,
+	// which the R5900's FPU doesn't support.
+	bool fast_math = false;
+	
+	// Clean up the pcode of each block before translating it, see
+	// PcodeOptimizer.
+	bool optimize_pcode = true;
+	
+	// Count how many times each block and CALL op runs, see
+	// create_profile_counters.
+	bool instrument = false;
+	
+	// Execution counts from a previous run to attach to the IR as branch
+	// weights and function entry counts, or empty for none. See
+	// QuadraProfile.
+	std::string profile_path;
+	
+	// Where to cache translated functions across runs, or empty to disable
+	// the cache.
+	std::string cache_directory;
+	
+	// If set, each function is written here as bitcode as soon as it's been
+	// translated, and its IR and Ghidra state are freed. link_workers reads
+	// them back in, so peak memory doesn't include both for every function.
+	std::string stream_directory;
+};
+
+// How a CALLOTHER is translated, see QuadraTranslator::create_userop_table.
+enum class UserOpKind {
+	SYSCALL,
+	VECTOR
+};
+
+struct UserOpLowering {
+	UserOpKind kind;
+	VectorUserOpInfo vector = {}; // For VECTOR.
+};
+
+// An ELF segment materialized as an LLVM global.
+struct QuadraSegment {
+	uint64_t vaddr;
+	uint64_t size; // memsz if read-only, filesz if writable.
+	bool writable; // Only the initial contents, which main copies into guest memory.
+	llvm::GlobalVariable* global;
 };
 
 static const bool STORE_REGISTERS_IN_GLOBAL = true;
@@ -30,9 +145,17 @@ static const bool STORE_REGISTERS_IN_GLOBAL = true;
 //
 // Basic blocks and pcode ops are fed to it using an immediate-style API, and
 // from that it generates all the necessary LLVM calls.
+//
+// Functions are discovered serially, since Ghidra isn't thread safe, but
+// they can then be translated on multiple threads by workers that each have
+// their own LLVM context and module. The workers' modules are linked back
+// into the parent's at the end.
 class QuadraTranslator {
 public:
-	QuadraTranslator(QuadraArchitecture* arch);
+	QuadraTranslator(QuadraArchitecture* arch, QuadraTranslatorOptions options);
+	
+	std::unique_ptr<QuadraTranslator> create_worker();
+	void link_workers(std::vector<std::unique_ptr<QuadraTranslator>> workers);
 	
 	void begin_function(QuadraFunction function);
 	void end_function();
@@ -40,45 +163,165 @@ public:
 	void end_block();
 	void translate_pcodeop(const PcodeOp& op);
 	
-	void print();
+	void create_main(llvm::Function* entry);
+	llvm::Module& module();
+	const PcodeStats& pcode_stats(); // Including those of linked workers.
+	
+	// Hand over ownership of the module and then its context, after which the
+	// translator can't be used.
+	std::unique_ptr<llvm::Module> take_module();
+	std::unique_ptr<llvm::LLVMContext> take_context();
 	
-	QuadraFunction* get_function(Address address, const char* name = nullptr);
+	QuadraFunction* get_function(Address address, const char* name = nullptr, uint64_t size = 0);
 	
+	// Once every function has been discovered, link in the cached ones. Cache
+	// entries that were translated against different callees are thrown away
+	// and those functions are processed by Ghidra instead. The functions
+	// still marked as cached don't need translating.
+	void load_cached_functions();
+	
+	// Kept as maps, unlike the per-function tables: pointers to the records
+	// are held while more functions are discovered, and the function table
+	// has to be sorted by address. They're looked up per function and call,
+	// not per varnode.
 	std::map<Address, QuadraFunction> discovered_functions;
 	std::map<Address, QuadraFunction> translated_functions;
 	
 private:
+	QuadraTranslator(QuadraArchitecture* arch, QuadraTranslatorOptions options, const QuadraTranslator* parent);
+	QuadraFunction* import_function(Address address); // Look up a worker's copy of a function from the parent.
+	
 	QuadraBlock* get_block(const FlowBlock* gblock);
 	llvm::Value* get_input(const Varnode* var); // Convert a Ghidra varnode to an LLVM value.
+	llvm::Value* get_optimized_input(const PcodeOp& op, int4 slot); // Get an input, as replaced by the pcode optimizer.
+	void set_output(const Varnode* var, llvm::Value* value);
 	llvm::Value* get_local(const Varnode* var); // Create an alloca for a varnode if it doesn't already exist, then return it.
 	llvm::Value* get_register(VarnodeData reg); // Get a pointer to a register.
+	llvm::Value* read_register(VarnodeData reg);
+	void write_register(VarnodeData reg, llvm::Value* value);
 	llvm::Value* create_pointer_to_register(VarnodeData reg, llvm::IRBuilder<>& builder); // Create a pointer to a register.
-	llvm::Value* decompress_pointer(llvm::Value* val, llvm::Value* hi, llvm::Type* ptr_type); // Take a truncated pointer, add on the hi 32 bits pf hi.
+	llvm::Value* guest_pointer(llvm::Value* address, llvm::Type* ptr_type, llvm::Value* memory_base); // Convert a guest address to a host pointer.
+	llvm::Value* segment_pointer(llvm::Value* address, int4 size); // Point into a read-only segment global if the address is a known constant.
 	
 	llvm::Value* register_storage();
 	
+	// SSA construction, following Braun et al., "Simple and Efficient
+	// Construction of Static Single Assignment Form". Variables are numbered
+	// with register slots first followed by all the other varnodes.
+	void create_register_slots(const std::map<VarnodeData, std::string>& registers);
+	size_t register_slot(VarnodeData reg);
+	size_t ssa_variable(VarnodeData var);
+	llvm::Type* ssa_type(size_t variable);
+	QuadraBlock& ssa_block(const BlockBasic* gblock);
+	std::vector<const BlockBasic*> predecessors(const BlockBasic* gblock);
+	llvm::Value* read_variable(size_t variable, const BlockBasic* gblock);
+	llvm::Value* read_variable_recursive(size_t variable, const BlockBasic* gblock);
+	void write_variable(size_t variable, const BlockBasic* gblock, llvm::Value* value);
+	llvm::Value* add_phi_operands(size_t variable, llvm::PHINode* phi, const BlockBasic* gblock);
+	llvm::Value* try_remove_trivial_phi(llvm::PHINode* phi);
+	void try_seal_block(const BlockBasic* gblock);
+	void clobber_registers(const std::vector<bool>& written);
+	void write_back_registers(const std::vector<bool>& observed);
+	void scan_registers(QuadraFunction& function);
+	void update_register_summaries();
+	void declare_bodies();
+	llvm::FunctionType* body_type(const RegisterSummary& registers);
+	unsigned int body_argument(size_t slot); // Index of the argument holding a register slot.
+	void create_entry_thunk();
+	llvm::Function* llvm_function(); // What the current function is being translated into.
+	std::string cache_key(Address address, uint64_t size);
+	std::string cache_dependencies(const QuadraFunction& function);
+	void store_in_cache();
+	void stream_function(); // Write out the current function and free it, see QuadraTranslatorOptions::stream_directory.
+	void link_streamed_functions();
+	std::string stream_path(Address address);
+	
+	std::vector<std::string> function_names(); // In module order.
+	void link_module(std::unique_ptr<llvm::Module> module);
+	void restore_functions(const std::vector<std::string>& order); // Fix up function pointers and order after linking.
+	void position_at_end(llvm::IRBuilder<>& builder, const BlockBasic* gblock);
+	
+	llvm::Value* overflow_flag(llvm::Intrinsic::ID id, llvm::Value* lhs, llvm::Value* rhs, int4 bytes); // Zero extended overflow bit of an *.with.overflow intrinsic.
 	llvm::Value* zero(int4 bytes);
+	llvm::Type* float_type(int4 bytes);
+	llvm::Value* to_float(llvm::Value* value); // Reinterpret an integer varnode value as a float.
+	llvm::Value* from_float(llvm::Value* value);
 	llvm::Type* int_type(int4 bytes);
 	
 	void create_printf_int(const char* fmt, llvm::Value* val);
 	
+	void create_userop_table();
+	bool is_syscall(const PcodeOp& op);
+	void translate_userop(const PcodeOp& op, llvm::ArrayRef<llvm::Value*> inputs);
+	llvm::Value* translate_vector_userop(const VectorUserOpInfo& userop, llvm::ArrayRef<llvm::Value*> operands, int4 size);
 	llvm::Function* create_syscall_dispatcher();
+	bool translate_direct_syscall(); // Call a syscall wrapper directly if the syscall number is known.
+	llvm::Value* call_syscall(const SyscallInfo& syscall, const std::vector<llvm::Value*>& arg_regs, llvm::Value* memory_base);
+	llvm::Function* get_syscall_wrapper(const SyscallInfo& syscall);
+	llvm::Type* syscall_type(PrimtiveType type);
+	void create_segment_globals();
+	void create_segment_table();
+	void create_function_table();
+	void create_profile_counters();
+	void increment_counter(size_t index);
+	void create_profile_table();
+	uint64_t block_count(const FlowBlock* gblock);
+	llvm::MDNode* branch_weights(const BlockBasic* from, const std::vector<const FlowBlock*>& to); // Null without a profile.
+	void set_entry_counts();
+	void set_profile_summary();
+	llvm::Function* function_finder(); // Maps a guest address to a host function, see create_function_table.
 
 	QuadraArchitecture* _arch;
+	QuadraTranslatorOptions _options;
+	const QuadraTranslator* _parent = nullptr; // Set for workers.
+	std::map<Address, QuadraFunction> _imported_functions;
 	
-	llvm::LLVMContext _context;
-	llvm::Module _module;
+	std::unique_ptr<llvm::LLVMContext> _context;
+	std::unique_ptr<llvm::Module> _module;
 	llvm::IRBuilder<> _builder;
 	
 	QuadraFunction _function;
 	const BlockBasic* _gblock = nullptr;
-	std::map<const BlockBasic*, QuadraBlock> _blocks;
+	std::vector<QuadraBlock> _blocks; // Indexed by BlockBasic::getIndex.
+	std::unique_ptr<PcodeOptimizer> _pcode_optimizer;
+	OptimizedBlock _optimized; // The current block.
+	llvm::Value* _condition = nullptr; // Result of the fused compare, for the CBRANCH.
 	
 	uintb _register_space_size = 0;
 	unsigned int _register_space;
 	llvm::Value* _registers_global;
+	AddrSpace* _ghidra_register_space;
+	std::vector<RegisterSlot> _register_slots;
+	RegisterSummary _syscall_registers;
+	RegisterSummary _indirect_registers; // Everything any function may access, for indirect calls.
+	bool _register_summaries_dirty = false;
+	bool _bodies_declared = false;
+	
+	std::vector<QuadraSegment> _segments;
+	
+	// 32-bit guests get a flat 4GiB address space reserved by the runtime,
+	// so a guest address is translated with a single add to its base.
+	bool _flat_memory = false;
+	llvm::GlobalVariable* _memory_base_global = nullptr;
+	llvm::GlobalVariable* _segment_table = nullptr;
+	llvm::Function* _main = nullptr;
+	
+	// With --instrument, the current function's counters. Blocks come first
+	// in Ghidra's order, followed by CALL ops.
+	llvm::GlobalVariable* _profile_counters = nullptr;
+	std::map<const PcodeOp*, size_t> _call_counters;
+	
+	std::shared_ptr<const QuadraProfile> _profile; // Shared with workers.
 	
 	llvm::Function* _syscall_dispatcher = nullptr;
+	std::map<int4, UserOpLowering> _userops; // Keyed by user-op index.
+	std::set<int4> _unsupported_userops; // Already warned about.
+	
+	std::shared_ptr<QuadraCache> _cache; // Shared with workers.
+	std::string _cache_salt; // Hash of everything outside a function that affects its translation.
+	std::map<Address, CachedFunction> _cached_functions;
+	std::map<Address, std::string> _function_names; // Names of discovered functions, which survive linking.
+	std::map<Address, std::string> _body_names;
 };
 
 #endif
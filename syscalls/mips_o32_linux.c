@@ -1,11 +1,14 @@
 #include <unistd.h>
 #include <linux/types.h>
 
+#include "runtime.h"
+
 #define TRACE(...) //__VA_ARGS__
 
 unsigned int qsys_exit(unsigned int error_code)
 {
 	TRACE(printf("exit(%d)\n", error_code));
+	__quadra_write_profile();
 	exit(error_code);
 }
 
@@ -32,3 +35,14 @@ unsigned int qsys_close(unsigned int fd)
 	TRACE(printf("close(%d)\n", fd));
 	close(fd);
 }
+
+unsigned int qsys_brk(unsigned int brk)
+{
+	TRACE(printf("brk(0x%x)\n", brk));
+	// The whole guest address space is already mapped, so moving the break
+	// is just bookkeeping.
+	if(brk >= __quadra_brk && brk < 0x70000000) {
+		__quadra_brk = brk;
+	}
+	return __quadra_brk;
+}
@@ -0,0 +1,188 @@
+#include "runtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define GUEST_MEMORY_SIZE 0x100000000ull
+#define GUEST_STACK_TOP 0x7fff0000u
+#define GUEST_PAGE_SIZE 0x1000u
+#define HOST_STACK_SIZE 0x4000000ull
+
+uint8_t* __quadra_memory_base;
+uint32_t __quadra_brk;
+
+static const struct QuadraProfileFunction* profile_functions;
+static uint64_t profile_function_count;
+
+static void write_u64(FILE* file, uint64_t value);
+
+uint32_t __quadra_init_memory(const struct QuadraSegmentEntry* segments, uint64_t segment_count)
+{
+	// Pages are only committed when touched, so reserving the whole 32-bit
+	// address space up front is cheap.
+	void* memory = mmap(NULL, GUEST_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(memory == MAP_FAILED) {
+		fprintf(stderr, "error: Failed to reserve guest memory.\n");
+		exit(1);
+	}
+	__quadra_memory_base = memory;
+	
+	uint64_t top = 0;
+	for(uint64_t i = 0; i < segment_count; i++) {
+		const struct QuadraSegmentEntry* segment = &segments[i];
+		if(segment->vaddr + segment->memsz > GUEST_STACK_TOP) {
+			fprintf(stderr, "error: Segment at 0x%lx overlaps the stack.\n", (unsigned long) segment->vaddr);
+			exit(1);
+		}
+		if(segment->data != NULL) {
+			memcpy(__quadra_memory_base + segment->vaddr, segment->data, segment->filesz);
+		}
+		if(segment->vaddr + segment->memsz > top) {
+			top = segment->vaddr + segment->memsz;
+		}
+	}
+	__quadra_brk = (top + GUEST_PAGE_SIZE - 1) & ~(uint64_t) (GUEST_PAGE_SIZE - 1);
+	
+	// The stack is already zeroed, so argc, argv, envp and auxv all read as
+	// empty.
+	return GUEST_STACK_TOP - 0x100;
+}
+
+void __quadra_map_segments(const struct QuadraSegmentEntry* segments, uint64_t segment_count)
+{
+	// Segments are sorted by address, but neighbours can share a page, so
+	// only the pages past the previous segment are mapped.
+	uint64_t mapped = 0;
+	for(uint64_t i = 0; i < segment_count; i++) {
+		const struct QuadraSegmentEntry* segment = &segments[i];
+		uint64_t start = segment->vaddr & ~(uint64_t) (GUEST_PAGE_SIZE - 1);
+		uint64_t end = (segment->vaddr + segment->memsz + GUEST_PAGE_SIZE - 1) & ~(uint64_t) (GUEST_PAGE_SIZE - 1);
+		if(start < mapped) {
+			start = mapped;
+		}
+		if(start < end) {
+			void* memory = mmap((void*) start, end - start, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+			if(memory != (void*) start) {
+				fprintf(stderr, "error: Failed to map the segment at 0x%lx.\n", (unsigned long) segment->vaddr);
+				exit(1);
+			}
+			mapped = end;
+		}
+		if(segment->data != NULL) {
+			memcpy((void*) segment->vaddr, segment->data, segment->filesz);
+		}
+	}
+}
+
+uint64_t __quadra_init_stack(void)
+{
+	void* stack = mmap(NULL, HOST_STACK_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if(stack == MAP_FAILED) {
+		fprintf(stderr, "error: Failed to map the guest stack.\n");
+		exit(1);
+	}
+	// Leave a guard page at the bottom so an overflow faults.
+	if(mprotect(stack, GUEST_PAGE_SIZE, PROT_NONE) != 0) {
+		fprintf(stderr, "error: Failed to protect the guest stack's guard page.\n");
+		exit(1);
+	}
+	return (uint64_t) stack + HOST_STACK_SIZE - 0x100;
+}
+
+void* __quadra_lookup_function(const struct QuadraFunctionEntry* functions, uint64_t function_count, uint64_t address)
+{
+	uint64_t low = 0;
+	uint64_t high = function_count;
+	while(low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if(functions[middle].address < address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if(low == function_count || functions[low].address != address) {
+		fprintf(stderr, "error: Indirect call to 0x%lx, which isn't a translated function.\n", (unsigned long) address);
+		exit(1);
+	}
+	return functions[low].function;
+}
+
+void __quadra_init_profile(const struct QuadraProfileFunction* functions, uint64_t function_count)
+{
+	profile_functions = functions;
+	profile_function_count = function_count;
+}
+
+void __quadra_write_profile(void)
+{
+	if(profile_functions == NULL) {
+		return;
+	}
+	const struct QuadraProfileFunction* functions = profile_functions;
+	profile_functions = NULL;
+	
+	const char* path = getenv("QUADRA_PROFILE");
+	if(path == NULL) {
+		path = "quadra.profile";
+	}
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		fprintf(stderr, "warning: Failed to write profile to %s.\n", path);
+		return;
+	}
+	
+	uint32_t version = QUADRA_PROFILE_VERSION;
+	fwrite(QUADRA_PROFILE_MAGIC, 4, 1, file);
+	fwrite(&version, sizeof(version), 1, file);
+	uint64_t hit_functions = 0;
+	for(uint64_t i = 0; i < profile_function_count; i++) {
+		for(uint64_t j = 0; j < functions[i].counter_count; j++) {
+			if(functions[i].counters[j].count != 0) {
+				hit_functions++;
+				break;
+			}
+		}
+	}
+	write_u64(file, hit_functions);
+	for(uint64_t i = 0; i < profile_function_count; i++) {
+		const struct QuadraProfileFunction* function = &functions[i];
+		uint64_t hit_counters = 0;
+		for(uint64_t j = 0; j < function->counter_count; j++) {
+			hit_counters += function->counters[j].count != 0;
+		}
+		if(hit_counters == 0) {
+			continue;
+		}
+		uint32_t name_size = strlen(function->name);
+		write_u64(file, function->address);
+		fwrite(&name_size, sizeof(name_size), 1, file);
+		fwrite(function->name, 1, name_size, file);
+		write_u64(file, hit_counters);
+		for(uint64_t j = 0; j < function->counter_count; j++) {
+			const struct QuadraCounter* counter = &function->counters[j];
+			if(counter->count == 0) {
+				continue;
+			}
+			uint8_t kind = counter->kind;
+			fwrite(&kind, sizeof(kind), 1, file);
+			write_u64(file, counter->address);
+			write_u64(file, counter->target);
+			write_u64(file, counter->count);
+		}
+	}
+	int error = ferror(file);
+	if(fclose(file) != 0 || error) {
+		fprintf(stderr, "warning: Failed to write profile to %s.\n", path);
+	}
+}
+
+static void write_u64(FILE* file, uint64_t value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
@@ -0,0 +1,101 @@
+#ifndef _QUADRA_RUNTIME_H
+#define _QUADRA_RUNTIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Emitted by the translator, one entry per PT_LOAD segment, and passed to
+// __quadra_init_memory or __quadra_map_segments.
+struct QuadraSegmentEntry {
+	uint64_t vaddr;
+	uint64_t filesz;
+	uint64_t memsz;
+	const uint8_t* data;
+};
+
+// Emitted by the translator, one entry per translated function, sorted by
+// address.
+struct QuadraFunctionEntry {
+	uint64_t address;
+	void* function;
+};
+
+// Emitted by the translator with --instrument, one per translated basic block
+// and CALL op.
+struct QuadraCounter {
+	uint64_t kind; // QUADRA_COUNTER_*.
+	uint64_t address; // Entry of the block, or address of the call.
+	uint64_t target; // The callee, for calls.
+	uint64_t count;
+};
+
+#define QUADRA_COUNTER_BLOCK 0
+#define QUADRA_COUNTER_CALL 1
+
+// Emitted by the translator with --instrument, one per translated function.
+struct QuadraProfileFunction {
+	uint64_t address;
+	const char* name;
+	uint64_t counter_count;
+	struct QuadraCounter* counters;
+};
+
+// Profiles are written to $QUADRA_PROFILE, or quadra.profile by default, in
+// host byte order. Only the functions and counters that were hit are
+// written.
+//
+//   char magic[4] = "QPRF"
+//   uint32_t version = QUADRA_PROFILE_VERSION
+//   uint64_t function_count
+//   for each function:
+//     uint64_t address
+//     uint32_t name_size
+//     char name[name_size]
+//     uint64_t counter_count
+//     for each counter:
+//       uint8_t kind
+//       uint64_t address
+//       uint64_t target
+//       uint64_t count
+#define QUADRA_PROFILE_MAGIC "QPRF"
+#define QUADRA_PROFILE_VERSION 1
+
+// Base of the 4GiB region holding the guest's address space. A guest address
+// is translated to a host pointer by adding it to this.
+extern uint8_t* __quadra_memory_base;
+
+// The current program break, as a guest address.
+extern uint32_t __quadra_brk;
+
+// Reserve guest memory, copy in the segments and set up the stack. Returns
+// the initial guest stack pointer.
+uint32_t __quadra_init_memory(const struct QuadraSegmentEntry* segments, uint64_t segment_count);
+
+// For 64-bit guests, which use host addresses directly, map the segments at
+// their addresses and copy them in. Exits if something is already there.
+void __quadra_map_segments(const struct QuadraSegmentEntry* segments, uint64_t segment_count);
+
+// For 64-bit guests, which use host addresses directly, map a stack that all
+// guest functions share. Returns the initial stack pointer.
+uint64_t __quadra_init_stack(void);
+
+// Find the translated function for a guest address, for indirect calls.
+// Exits if there isn't one.
+void* __quadra_lookup_function(const struct QuadraFunctionEntry* functions, uint64_t function_count, uint64_t address);
+
+// Remember the counters of an instrumented program so that they can be written
+// out when it exits.
+void __quadra_init_profile(const struct QuadraProfileFunction* functions, uint64_t function_count);
+
+// Write out the profile, if the program is instrumented. Only the first call
+// does anything.
+void __quadra_write_profile(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+// Prints the profile written by a program translated with --instrument, with
+// the hottest blocks and calls first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+struct Function {
+	uint64_t address;
+	char* name;
+};
+
+struct Counter {
+	uint8_t kind;
+	uint64_t address;
+	uint64_t target;
+	uint64_t count;
+	const struct Function* function;
+};
+
+static void read_or_die(void* data, size_t size, FILE* file);
+static const char* function_name(const struct Function* functions, uint64_t function_count, uint64_t address);
+static int compare_counters(const void* l, const void* r);
+
+int main(int argc, char** argv)
+{
+	if(argc < 2 || argc > 3) {
+		printf("usage: quadra_profile <profile> [max rows]\n");
+		return 1;
+	}
+	uint64_t max_rows = argc == 3 ? strtoull(argv[2], NULL, 10) : UINT64_MAX;
+
+	FILE* file = fopen(argv[1], "rb");
+	if(file == NULL) {
+		fprintf(stderr, "error: Failed to open %s.\n", argv[1]);
+		return 1;
+	}
+	char magic[4];
+	uint32_t version;
+	read_or_die(magic, sizeof(magic), file);
+	read_or_die(&version, sizeof(version), file);
+	if(memcmp(magic, QUADRA_PROFILE_MAGIC, 4) != 0 || version != QUADRA_PROFILE_VERSION) {
+		fprintf(stderr, "error: %s isn't a version %d profile.\n", argv[1], QUADRA_PROFILE_VERSION);
+		return 1;
+	}
+
+	uint64_t function_count;
+	read_or_die(&function_count, sizeof(function_count), file);
+	struct Function* functions = calloc(function_count, sizeof(struct Function));
+	struct Counter* counters = NULL;
+	uint64_t counter_count = 0;
+	for(uint64_t i = 0; i < function_count; i++) {
+		uint32_t name_size;
+		uint64_t function_counters;
+		read_or_die(&functions[i].address, sizeof(uint64_t), file);
+		read_or_die(&name_size, sizeof(name_size), file);
+		functions[i].name = calloc(name_size + 1, 1);
+		read_or_die(functions[i].name, name_size, file);
+		read_or_die(&function_counters, sizeof(function_counters), file);
+		counters = realloc(counters, (counter_count + function_counters) * sizeof(struct Counter));
+		for(uint64_t j = 0; j < function_counters; j++) {
+			struct Counter* counter = &counters[counter_count++];
+			read_or_die(&counter->kind, sizeof(counter->kind), file);
+			read_or_die(&counter->address, sizeof(uint64_t), file);
+			read_or_die(&counter->target, sizeof(uint64_t), file);
+			read_or_die(&counter->count, sizeof(uint64_t), file);
+			counter->function = &functions[i];
+		}
+	}
+	fclose(file);
+
+	qsort(counters, counter_count, sizeof(struct Counter), compare_counters);
+	uint64_t rows = 0;
+	printf("%16s  %-16s  %s\n", "blocks", "address", "location");
+	for(uint64_t i = 0; i < counter_count && rows < max_rows; i++) {
+		const struct Counter* counter = &counters[i];
+		if(counter->kind == QUADRA_COUNTER_BLOCK) {
+			printf("%16lu  %016lx  %s+0x%lx\n",
+				(unsigned long) counter->count,
+				(unsigned long) counter->address,
+				counter->function->name,
+				(unsigned long) (counter->address - counter->function->address));
+			rows++;
+		}
+	}
+	rows = 0;
+	printf("\n%16s  %-16s  %s\n", "calls", "address", "caller -> callee");
+	for(uint64_t i = 0; i < counter_count && rows < max_rows; i++) {
+		const struct Counter* counter = &counters[i];
+		if(counter->kind == QUADRA_COUNTER_CALL) {
+			printf("%16lu  %016lx  %s -> %s\n",
+				(unsigned long) counter->count,
+				(unsigned long) counter->address,
+				counter->function->name,
+				function_name(functions, function_count, counter->target));
+			rows++;
+		}
+	}
+	return 0;
+}
+
+static void read_or_die(void* data, size_t size, FILE* file)
+{
+	if(size != 0 && fread(data, size, 1, file) != 1) {
+		fprintf(stderr, "error: Profile is truncated.\n");
+		exit(1);
+	}
+}
+
+static const char* function_name(const struct Function* functions, uint64_t function_count, uint64_t address)
+{
+	// A callee that was called has its entry block counted, so it's listed
+	// unless it wasn't translated.
+	static char unknown[32];
+	for(uint64_t i = 0; i < function_count; i++) {
+		if(functions[i].address == address) {
+			return functions[i].name;
+		}
+	}
+	snprintf(unknown, sizeof(unknown), "0x%lx", (unsigned long) address);
+	return unknown;
+}
+
+static int compare_counters(const void* l, const void* r)
+{
+	const struct Counter* lhs = l;
+	const struct Counter* rhs = r;
+	if(lhs->count != rhs->count) {
+		return lhs->count < rhs->count ? 1 : -1;
+	}
+	return lhs->address < rhs->address ? -1 : lhs->address > rhs->address;
+}